@@ -9,10 +9,26 @@
 #include <linux/slab.h>
 #include <linux/delay.h>
 #include <linux/atomic.h>
-#include <linux/timer.h>
-#include <linux/jiffies.h>
+#include <linux/hrtimer.h>
+#include <linux/math64.h>
 #include <linux/cred.h>
 #include <linux/uidgid.h>
+#include <linux/spinlock.h>
+#include <linux/seqlock.h>
+#include <linux/mm.h>
+#include <linux/vmalloc.h>
+#include <linux/poll.h>
+#include <linux/wait.h>
+#include <linux/bitops.h>
+#include <linux/workqueue.h>
+#include <linux/version.h>
+#include <linux/moduleparam.h>
+#include <linux/string.h>
+#include <linux/list.h>
+#include <linux/rculist.h>
+#include <linux/mutex.h>
+#include <linux/cache.h>
+#include <linux/sched.h>
 
 MODULE_LICENSE("GPL");
 MODULE_AUTHOR("Simon Slamka of Ongakken Corp.");
@@ -22,54 +38,316 @@ MODULE_VERSION("0.7");
 // constants
 
 #define KB_KEY_MAX 768
+#define KB_KEY_DIRECT_CUNT 128
+#define KB_KEY_SLOT_CUNT (KB_KEY_DIRECT_CUNT + ARRAY_SIZE(kb_key_extra))
+#define KB_KEY_SLOT_OVERFLOW 0
 #define KB_WINDOW_CUNT 8
+#define KB_WINDOW_MASK_ALL ((1U << KB_WINDOW_CUNT) - 1)
 
 #define KB_SAT_ADD32(a, b) ((uint32_t)((a) > (U32_MAX - (b)) ? U32_MAX : ((a) + (b))))
 #define KB_SAT_ADD64(a, b) ((uint64_t)((a) > (U64_MAX - (b)) ? U64_MAX : ((a) + (b))))
-#define KB_SECS_RING_SIZE 60
-#define KB_MINS_RING_SIZE 60
-#define KB_HOURS_RING_SIZE 24
-#define KB_DAYS_RING_SIZE 365
+#define KB_SAT_SUB(a, b) (((a) > (b)) ? ((a) - (b)) : 0)
+#define KB_SECS_KEPT_DEFAULT 60
+#define KB_MINS_KEPT_DEFAULT 60
+#define KB_HOURS_KEPT_DEFAULT 24
+#define KB_DAYS_KEPT_DEFAULT 365
+#define KB_TIER_CUNT 4
+#define KB_TIER_MASK_ALL ((1U << KB_TIER_CUNT) - 1)
+#define KB_TIER_NONE U32_MAX
+#define KB_MAX_KB_DEFAULT 8192
 #define KB_MIN_GAP_NS 1000000
+#define KB_RATE_SLOT_NS 10000000
+#define KB_RATE_SLOT_CUNT 100
+#define KB_MAP_FULL_OFF 0x10000
+#define KB_TICK_REC_RING_SIZE 64
+#define KB_PHYS_LEN 64
+#define KB_KBD_LIST_MAX 64
+#define KB_VP_LIST_MAX 16
+
+// module params
+
+static char *kb_clock = "input";
+module_param_named(clock, kb_clock, charp, 0444);
+MODULE_PARM_DESC(clock, "event timestamp source: input (frame timestamp recorded by the input core, default) or ktime (ktime_get_ns() in the handler)");
+
+static char *kb_allow = "";
+module_param_named(allow, kb_allow, charp, 0444);
+MODULE_PARM_DESC(allow, "comma-separated hex vendor:product pairs to attach to even without alphanumeric keys");
+
+static char *kb_deny = "";
+module_param_named(deny, kb_deny, charp, 0444);
+MODULE_PARM_DESC(deny, "comma-separated hex vendor:product pairs never to attach to; wins over allow");
+
+static unsigned int kb_secs_kept = KB_SECS_KEPT_DEFAULT;
+module_param_named(secs, kb_secs_kept, uint, 0444);
+MODULE_PARM_DESC(secs, "closed seconds kept, 1-3600 (default 60); also the span of the 1m window");
+
+static unsigned int kb_mins_kept = KB_MINS_KEPT_DEFAULT;
+module_param_named(mins, kb_mins_kept, uint, 0444);
+MODULE_PARM_DESC(mins, "closed minutes kept, 1-1440 (default 60); windows longer than their ring are cut to it");
+
+static unsigned int kb_hours_kept = KB_HOURS_KEPT_DEFAULT;
+module_param_named(hours, kb_hours_kept, uint, 0444);
+MODULE_PARM_DESC(hours, "closed hours kept, 1-8760 (default 24); also the span of the 24h window");
+
+static unsigned int kb_days_kept = KB_DAYS_KEPT_DEFAULT;
+module_param_named(days, kb_days_kept, uint, 0444);
+MODULE_PARM_DESC(days, "closed days kept, 1-3650 (default 365); also the span of the 365d window");
+
+static unsigned int kb_perkey_tiers = KB_TIER_MASK_ALL;
+module_param_named(perkey, kb_perkey_tiers, uint, 0444);
+MODULE_PARM_DESC(perkey, "tiers whose slots keep per-key counts: 0x1 seconds, 0x2 minutes, 0x4 hours, 0x8 days (default 0xf); windows over the others read per-key as zero");
+
+static unsigned int kb_max_kb = KB_MAX_KB_DEFAULT;
+module_param_named(max_kb, kb_max_kb, uint, 0444);
+MODULE_PARM_DESC(max_kb, "KiB cap on all tier arenas together, the all-device set plus every device's (default 8192); load fails if the all-device set alone needs more, and devices past it aren't attached");
+
+// hold/gap histograms: units of 2^17 ns (~131 us), 8 linear bins then 4 per octave up to ~4.3 s
+
+#define KB_HIST_UNIT_SHIFT 17
+#define KB_HIST_SUB_BITS 3
+#define KB_HIST_SUB_MASK ((1ULL << KB_HIST_SUB_BITS) - 1)
+#define KB_HIST_BIN_CUNT 56
+
+// ioctls
+
+#define KB_IOC_MAGIC 'k'
+
+// per-second deltas for outside consumers; a streaming fd keeps the tick armed, so kaybeestatd doesn't use it
+
+#define KB_IOC_STREAM _IOW(KB_IOC_MAGIC, 1, uint32_t)
+#define KB_IOC_QUERY _IOWR(KB_IOC_MAGIC, 2, kb_query_t)
+#define KB_IOC_KBD_LIST _IOWR(KB_IOC_MAGIC, 3, kb_kbd_list_t)
+#define KB_IOC_KBD_QUERY _IOWR(KB_IOC_MAGIC, 4, kb_kbd_query_t)
+#define KB_IOC_RANGE _IOWR(KB_IOC_MAGIC, 5, kb_range_query_t)
+
+// query field mask; scalar covers counts, rates, variances and percentiles, per-key switches to kb_window_stats_t
+
+#define KB_QUERY_SCALAR 0x1
+#define KB_QUERY_PERKEY 0x2
+#define KB_QUERY_FIELDS_ALL (KB_QUERY_SCALAR | KB_QUERY_PERKEY)
+
+// key classes; kb_key_class[] holds a bitmask of BIT(class) per code. codes past the table have no class
+
+#define KB_KEY_CLASS_PRINTABLE 0
+#define KB_KEY_CLASS_MODIFIER 1
+#define KB_KEY_CLASS_NAVIGATION 2
+#define KB_KEY_CLASS_FUNCTION 3
+#define KB_KEY_CLASS_NUMPAD 4
+#define KB_KEY_CLASS_DELETION 5
+#define KB_KEY_CLASS_WHITESPACE 6
+#define KB_KEY_CLASS_CUNT 7
+#define KB_KEY_CLASS_TABLE_SIZE 256
+
+// key slots: direct codes, then kb_key_extra, then one overflow slot read back as KEY_RESERVED
+
+static const uint16_t kb_key_extra[] = {
+    KEY_F13, KEY_F14, KEY_F15, KEY_F16, KEY_F17, KEY_F18, KEY_F19, KEY_F20, KEY_F21, KEY_F22, KEY_F23, KEY_F24,
+    KEY_NEXTSONG, KEY_PLAYPAUSE, KEY_PREVIOUSSONG, KEY_STOPCD, KEY_PRINT, KEY_BRIGHTNESSDOWN, KEY_BRIGHTNESSUP,
+};
+
+static const uint8_t kb_key_class[KB_KEY_CLASS_TABLE_SIZE] = {
+    [KEY_1 ... KEY_0] = BIT(KB_KEY_CLASS_PRINTABLE),
+    [KEY_MINUS] = BIT(KB_KEY_CLASS_PRINTABLE),
+    [KEY_EQUAL] = BIT(KB_KEY_CLASS_PRINTABLE),
+    [KEY_BACKSPACE] = BIT(KB_KEY_CLASS_DELETION),
+    [KEY_TAB] = BIT(KB_KEY_CLASS_WHITESPACE),
+    [KEY_Q ... KEY_RIGHTBRACE] = BIT(KB_KEY_CLASS_PRINTABLE),
+    [KEY_ENTER] = BIT(KB_KEY_CLASS_WHITESPACE),
+    [KEY_LEFTCTRL] = BIT(KB_KEY_CLASS_MODIFIER),
+    [KEY_A ... KEY_GRAVE] = BIT(KB_KEY_CLASS_PRINTABLE),
+    [KEY_LEFTSHIFT] = BIT(KB_KEY_CLASS_MODIFIER),
+    [KEY_BACKSLASH ... KEY_SLASH] = BIT(KB_KEY_CLASS_PRINTABLE),
+    [KEY_RIGHTSHIFT] = BIT(KB_KEY_CLASS_MODIFIER),
+    [KEY_KPASTERISK] = BIT(KB_KEY_CLASS_NUMPAD),
+    [KEY_LEFTALT] = BIT(KB_KEY_CLASS_MODIFIER),
+    [KEY_SPACE] = BIT(KB_KEY_CLASS_PRINTABLE) | BIT(KB_KEY_CLASS_WHITESPACE),
+    [KEY_F1 ... KEY_F10] = BIT(KB_KEY_CLASS_FUNCTION),
+    [KEY_NUMLOCK] = BIT(KB_KEY_CLASS_NUMPAD),
+    [KEY_KP7 ... KEY_KPDOT] = BIT(KB_KEY_CLASS_NUMPAD),
+    [KEY_F11 ... KEY_F12] = BIT(KB_KEY_CLASS_FUNCTION),
+    [KEY_KPENTER] = BIT(KB_KEY_CLASS_NUMPAD) | BIT(KB_KEY_CLASS_WHITESPACE),
+    [KEY_RIGHTCTRL] = BIT(KB_KEY_CLASS_MODIFIER),
+    [KEY_KPSLASH] = BIT(KB_KEY_CLASS_NUMPAD),
+    [KEY_RIGHTALT] = BIT(KB_KEY_CLASS_MODIFIER),
+    [KEY_HOME ... KEY_INSERT] = BIT(KB_KEY_CLASS_NAVIGATION),
+    [KEY_DELETE] = BIT(KB_KEY_CLASS_DELETION),
+    [KEY_KPEQUAL] = BIT(KB_KEY_CLASS_NUMPAD),
+    [KEY_KPCOMMA] = BIT(KB_KEY_CLASS_NUMPAD),
+    [KEY_LEFTMETA ... KEY_RIGHTMETA] = BIT(KB_KEY_CLASS_MODIFIER),
+    [KEY_F13 ... KEY_F24] = BIT(KB_KEY_CLASS_FUNCTION),
+};
 
 // data structures
 
+// sums of squared durations outgrow 64 bits after a handful of multi-second gaps
+
+typedef struct
+{
+    uint64_t lo;
+    uint64_t hi;
+} kb_u128_t;
+
 typedef struct
 {
     uint32_t press_cunt;
     uint32_t release_cunt;
-    uint32_t char_cunt;
     uint32_t char_del_cunt;
     uint32_t word_del_cunt;
+    uint32_t class_cunt[KB_KEY_CLASS_CUNT];
+    uint32_t peak_press_cunt;
     uint64_t hold_sum_ns;
     uint32_t hold_cunt;
-    uint64_t hold_m2;
+    kb_u128_t hold_sumsq;
     uint64_t longest_hold_ns;
     uint64_t gap_sum_ns;
     uint32_t gap_cunt;
-    uint64_t gap_m2;
+    kb_u128_t gap_sumsq;
     uint64_t shortest_gap_ns;
     uint64_t longest_gap_ns;
-    uint32_t per_key_cunt[KB_KEY_MAX];
+    uint32_t hold_hist[KB_HIST_BIN_CUNT];
+    uint32_t gap_hist[KB_HIST_BIN_CUNT];
+    uint32_t key_cunt[KB_KEY_SLOT_CUNT];
 } kb_bucket_t;
 
-static inline int kb_key_printable_is(unsigned int code)
+static inline kb_u128_t kb_u128_mul(uint64_t a, uint64_t b)
+{
+    kb_u128_t r;
+
+#ifdef CONFIG_ARCH_SUPPORTS_INT128
+    u128 p = (u128)a * b;
+
+    r.lo = (uint64_t)p;
+    r.hi = (uint64_t)(p >> 64);
+#else
+    uint64_t a_lo = (uint32_t)a;
+    uint64_t a_hi = a >> 32;
+    uint64_t b_lo = (uint32_t)b;
+    uint64_t b_hi = b >> 32;
+    uint64_t mid = a_hi * b_lo + ((a_lo * b_lo) >> 32);
+    uint64_t mid2 = a_lo * b_hi + (uint32_t)mid;
+
+    r.lo = a * b;
+    r.hi = a_hi * b_hi + (mid >> 32) + (mid2 >> 32);
+#endif
+
+    return r;
+}
+
+static inline void kb_u128_add(kb_u128_t *a, kb_u128_t b)
+{
+    a->lo += b.lo;
+    a->hi += b.hi + (a->lo < b.lo);
+}
+
+static inline void kb_u128_sub(kb_u128_t *a, kb_u128_t b)
 {
-    if (code >= KEY_1 && code <= KEY_0) { return 1; }
+    if (a->hi < b.hi || (a->hi == b.hi && a->lo < b.lo))
+    {
+        a->lo = 0;
+        a->hi = 0;
+        return;
+    }
 
-    if (code >= KEY_Q && code <= KEY_P) { return 1; }
+    a->hi -= b.hi + (a->lo < b.lo);
+    a->lo -= b.lo;
+}
 
-    if (code >= KEY_A && code <= KEY_APOSTROPHE) { return 1; }
+static uint64_t kb_u128_div(kb_u128_t n, uint64_t d)
+{
+    uint64_t q = 0;
+    uint64_t r = 0;
+    uint64_t top = 0;
+    int i = 0;
 
-    if (code >= KEY_Z && code <= KEY_SLASH) { return 1; }
+    if (n.hi >= d) { return U64_MAX; }
 
-    if (code == KEY_SPACE || code == KEY_MINUS || code == KEY_EQUAL) { return 1; }
+    if (n.hi == 0) { return div64_u64(n.lo, d); }
 
-    if (code == KEY_LEFTBRACE || code == KEY_RIGHTBRACE || code == KEY_BACKSLASH) { return 1; }
+    r = n.hi;
 
-    if (code == KEY_GRAVE) { return 1; }
+    for (i = 63; i >= 0; i--)
+    {
+        top = r >> 63;
+        r = (r << 1) | ((n.lo >> i) & 1);
+        q <<= 1;
 
-    return 0;
+        if (top || r >= d)
+        {
+            r -= d;
+            q |= 1;
+        }
+    }
+
+    return q;
+}
+
+// population variance: (sumsq - sum^2 / n) / n
+
+static uint64_t kb_var_ns(uint64_t sum_ns, kb_u128_t sumsq, uint32_t cunt)
+{
+    uint64_t mean = 0;
+    uint64_t rem = 0;
+
+    if (cunt == 0) { return 0; }
+
+    mean = div64_u64_rem(sum_ns, cunt, &rem);
+    kb_u128_sub(&sumsq, kb_u128_mul(sum_ns, mean));
+    kb_u128_sub(&sumsq, (kb_u128_t){ mul_u64_u64_div_u64(sum_ns, rem, cunt), 0 });
+
+    return kb_u128_div(sumsq, cunt);
+}
+
+static inline unsigned int kb_hist_bin(uint64_t ns)
+{
+    uint64_t u = ns >> KB_HIST_UNIT_SHIFT;
+    unsigned int shift = (unsigned int)fls64(u | KB_HIST_SUB_MASK) - KB_HIST_SUB_BITS;
+    unsigned int bin = (shift << (KB_HIST_SUB_BITS - 1)) + (unsigned int)(u >> shift);
+
+    return min_t(unsigned int, bin, KB_HIST_BIN_CUNT - 1);
+}
+
+static uint64_t kb_hist_bin_mid_ns(unsigned int bin)
+{
+    unsigned int shift = 0;
+    uint64_t lo = bin;
+
+    if (bin >= (1U << KB_HIST_SUB_BITS))
+    {
+        shift = (bin >> (KB_HIST_SUB_BITS - 1)) - 1;
+        lo = (uint64_t)(bin - (shift << (KB_HIST_SUB_BITS - 1))) << shift;
+    }
+
+    return (lo << KB_HIST_UNIT_SHIFT) + ((1ULL << (shift + KB_HIST_UNIT_SHIFT)) >> 1);
+}
+
+// pct-th percentile as the midpoint of the bin holding that rank, capped at the observed maximum
+
+static uint64_t kb_hist_pct_ns(const uint32_t *hist, uint32_t pct, uint64_t max_ns)
+{
+    uint64_t total = 0;
+    uint64_t rank = 0;
+    uint64_t seen = 0;
+    unsigned int bin = 0;
+
+    for (bin = 0; bin < KB_HIST_BIN_CUNT; bin++) { total += hist[bin]; }
+
+    if (total == 0) { return 0; }
+
+    rank = div_u64(total * pct + 99, 100);
+
+    for (bin = 0; bin < KB_HIST_BIN_CUNT; bin++)
+    {
+        seen += hist[bin];
+        if (seen >= rank) { break; }
+    }
+
+    return min(kb_hist_bin_mid_ns(min_t(unsigned int, bin, KB_HIST_BIN_CUNT - 1)), max_ns);
+}
+
+static inline int kb_bucket_idle_is(const kb_bucket_t *b)
+{
+    return b->press_cunt == 0 && b->release_cunt == 0;
 }
 
 typedef struct
@@ -89,6 +367,13 @@ typedef struct
     uint64_t gap_var_ns;
     uint64_t shortest_gap_ns;
     uint64_t longest_gap_ns;
+    uint64_t hold_p50_ns;
+    uint64_t hold_p90_ns;
+    uint64_t hold_p99_ns;
+    uint64_t gap_p50_ns;
+    uint64_t gap_p90_ns;
+    uint64_t gap_p99_ns;
+    uint64_t class_cunt[KB_KEY_CLASS_CUNT];
     uint32_t per_key_cunt[KB_KEY_MAX];
 } kb_window_stats_t;
 
@@ -118,6 +403,13 @@ typedef struct
     uint64_t gap_var_ns;
     uint64_t shortest_gap_ns;
     uint64_t longest_gap_ns;
+    uint64_t hold_p50_ns;
+    uint64_t hold_p90_ns;
+    uint64_t hold_p99_ns;
+    uint64_t gap_p50_ns;
+    uint64_t gap_p90_ns;
+    uint64_t gap_p99_ns;
+    uint64_t class_cunt[KB_KEY_CLASS_CUNT];
 } kb_window_stats_pub_t;
 
 typedef struct
@@ -129,328 +421,1747 @@ typedef struct
     kb_window_stats_pub_t windows[KB_WINDOW_CUNT];
 } kb_stats_pub_t;
 
-// tiered ring buffers
+// selective query: one record per set window bit, in window order
+
+typedef struct
+{
+    uint32_t window_mask;
+    uint32_t field_mask;
+    uint64_t uptime_ns;
+    uint64_t buff;
+    uint64_t buff_len;
+} kb_query_t;
+
+// per-device queries: devices are matched on vendor, product and phys
+
+typedef struct
+{
+    uint16_t vendor;
+    uint16_t product;
+    uint32_t pudding;
+    char phys[KB_PHYS_LEN];
+} kb_kbd_id_t;
+
+// cunt comes back as the number of connected devices, even if fewer fit in buff
+
+typedef struct
+{
+    uint32_t cunt;
+    uint32_t pudding;
+    uint64_t buff;
+    uint64_t buff_len;
+} kb_kbd_list_t;
+
+typedef struct
+{
+    kb_kbd_id_t id;
+    kb_query_t query;
+} kb_kbd_query_t;
+
+// range query: len closed slots of tier, skipping the off newest; the slot still filling never counts
+
+typedef struct
+{
+    uint32_t tier;
+    uint32_t off;
+    uint32_t len;
+    uint32_t pudding;
+    uint64_t uptime_ns;
+    kb_window_stats_pub_t stats;
+} kb_range_query_t;
+
+// streaming mode: one record per closed second
+
+typedef struct
+{
+    uint64_t tick;
+    uint32_t press_cunt;
+    uint32_t release_cunt;
+    uint32_t char_cunt;
+    uint32_t char_del_cunt;
+    uint32_t word_del_cunt;
+    uint32_t hold_cunt;
+    uint32_t gap_cunt;
+    uint32_t peak_press_cunt;
+    uint64_t hold_sum_ns;
+    uint64_t hold_var_ns;
+    uint64_t longest_hold_ns;
+    uint64_t gap_sum_ns;
+    uint64_t gap_var_ns;
+    uint64_t shortest_gap_ns;
+    uint64_t longest_gap_ns;
+} kb_tick_rec_t;
+
+// mmap layout; seq is odd while stats is rewritten, uptime_ns stamps the last rewrite
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t pudding;
+    kb_stats_pub_t stats;
+} kb_map_pub_t;
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t pudding;
+    kb_stats_t stats;
+} kb_map_t;
+
+// per-open state; stats is sized at open for the full or the public record
+
+typedef struct
+{
+    int stream;
+    int root;
+    uint64_t next_tick;
+    struct mutex lock;
+    kb_bucket_t *scratch;
+    void *stats;
+} kb_file_t;
+
+typedef struct
+{
+    kb_bucket_t acc;
+    size_t span;
+    size_t bucket_secs;
+} kb_window_agg_t;
+
+// running totals of the additive bucket fields; wrap freely, only differences of two entries are read
+
+typedef struct
+{
+    uint64_t press_cunt;
+    uint64_t release_cunt;
+    uint64_t char_del_cunt;
+    uint64_t word_del_cunt;
+    uint64_t class_cunt[KB_KEY_CLASS_CUNT];
+    uint64_t hold_sum_ns;
+    uint64_t hold_cunt;
+    kb_u128_t hold_sumsq;
+    uint64_t gap_sum_ns;
+    uint64_t gap_cunt;
+    kb_u128_t gap_sumsq;
+    uint32_t hold_hist[KB_HIST_BIN_CUNT];
+    uint32_t gap_hist[KB_HIST_BIN_CUNT];
+} kb_prefix_t;
+
+typedef struct
+{
+    uint64_t longest_hold_ns;
+    uint64_t shortest_gap_ns;
+    uint64_t longest_gap_ns;
+    uint32_t peak_press_cunt;
+    uint32_t pudding;
+} kb_ext_t;
+
+// per-tier range index: prefix sums plus a segment tree of extremes; once flat passes size only pidx moves
+
+typedef struct
+{
+    kb_prefix_t *prefix;
+    kb_ext_t *ext;
+    size_t pidx;
+    size_t flat;
+} kb_tier_range_t;
+
+// one tier's ring; stride drops key_cunt on tiers without per-key counts
+
+typedef struct
+{
+    char *base;
+    size_t size;
+    size_t stride;
+    size_t idx;
+} kb_ring_t;
+
+// one set of tiers and windows, kb_glob's or a device's; ranges and scratch are kb_glob's only
+
+typedef struct
+{
+    kb_ring_t rings[KB_TIER_CUNT];
+    uint64_t gen[KB_TIER_CUNT];
+    uint64_t snap_gen[KB_TIER_CUNT];
+    kb_bucket_t *pend;
+    kb_bucket_t *closed;
+    kb_window_agg_t *windows;
+    kb_window_agg_t *snap;
+    kb_tier_range_t *ranges;
+    kb_bucket_t *scratch;
+    void *arena;
+    size_t arena_size;
+    uint64_t born_ns;
+} kb_tiers_t;
+
+// per-device state; lock guards live against the timer and readers, the rest is event path only.
+// tiers has no arena past max_kb, and such a device only feeds kb_glob
+
+typedef struct
+{
+    struct input_handle handle;
+    struct list_head node;
+    kb_kbd_id_t id;
+    kb_tiers_t tiers;
+
+    spinlock_t lock ____cacheline_aligned_in_smp;
+
+    uint64_t last_press_ns ____cacheline_aligned_in_smp;
+    uint64_t rate_head;
+    uint32_t rate_idx;
+    uint32_t rate_cunt;
+    uint8_t ctrl_held;
+    uint8_t alt_held;
+
+    kb_bucket_t live ____cacheline_aligned_in_smp;
+
+    uint64_t key_press_ts[KB_KEY_MAX] ____cacheline_aligned_in_smp;
+    uint16_t rate_slots[KB_RATE_SLOT_CUNT];
+} kb_kbd_t;
+
+// connected devices; added and removed under kb_kbd_mutex and kb_lock, walked under either or rcu
+
+static LIST_HEAD(kb_kbds);
+static DEFINE_MUTEX(kb_kbd_mutex);
+
+// all devices together
+
+static kb_tiers_t kb_glob;
+
+// tier and window geometry; a parent's secs is a whole multiple of its child's, window 0 spans the whole seconds ring
+
+typedef struct
+{
+    uint32_t secs;
+    uint32_t parent;
+    const unsigned int *kept;
+    unsigned int kept_max;
+    const char *param;
+} kb_tier_desc_t;
+
+typedef struct
+{
+    uint32_t tier;
+    uint32_t span;
+} kb_window_desc_t;
+
+static const kb_tier_desc_t kb_tier_descs[KB_TIER_CUNT] = {
+    { .secs = 1, .parent = 1, .kept = &kb_secs_kept, .kept_max = 3600, .param = "secs" },
+    { .secs = 60, .parent = 2, .kept = &kb_mins_kept, .kept_max = 1440, .param = "mins" },
+    { .secs = 3600, .parent = 3, .kept = &kb_hours_kept, .kept_max = 8760, .param = "hours" },
+    { .secs = 86400, .parent = KB_TIER_NONE, .kept = &kb_days_kept, .kept_max = 3650, .param = "days" },
+};
+
+static const kb_window_desc_t kb_window_descs[KB_WINDOW_CUNT] = {
+    { .tier = 0, .span = 0 },
+    { .tier = 1, .span = 5 },
+    { .tier = 1, .span = 30 },
+    { .tier = 2, .span = 6 },
+    { .tier = 2, .span = 0 },
+    { .tier = 3, .span = 7 },
+    { .tier = 3, .span = 30 },
+    { .tier = 3, .span = 0 },
+};
+
+// the timer fills closed[kb_closed_cur] while the worker drains the other half; written under kb_snap_seq
+
+static uint64_t kb_closed_secs[2] = { 0, 0 };
+static size_t kb_closed_cur = 0;
+
+// mmap-able stats refreshed every tick; offset 0 is public, KB_MAP_FULL_OFF is root-only
+
+static kb_map_pub_t *kb_map_pub = NULL;
+static kb_map_t *kb_map_full = NULL;
+
+// kb_glob.gen as of the last map refresh; worker only
+
+static uint64_t kb_map_gen[KB_TIER_CUNT] = { [0 ... KB_TIER_CUNT - 1] = U64_MAX };
 
-static kb_bucket_t kb_live;
-static kb_bucket_t *kb_secs_ring = NULL;
-static kb_bucket_t *kb_mins_ring = NULL;
-static kb_bucket_t *kb_hours_ring = NULL;
-static kb_bucket_t *kb_days_ring = NULL;
+// closed-second records for streaming readers, indexed by tick; written under kb_snap_seq
 
-static size_t kb_secs_idx = 0;
-static size_t kb_mins_idx = 0;
-static size_t kb_hours_idx = 0;
-static size_t kb_days_idx = 0;
+static kb_tick_rec_t kb_tick_recs[KB_TICK_REC_RING_SIZE];
+static DECLARE_WAIT_QUEUE_HEAD(kb_tick_wq);
 
-// hold tracking
+// code -> slot, filled at init
 
-static uint64_t kb_key_press_ts[KB_KEY_MAX];
-static uint64_t kb_last_press_ns = 0;
+static uint8_t kb_key_slot[KB_KEY_MAX] __read_mostly;
 
-// modifier tracking
+typedef struct
+{
+    uint16_t vendor;
+    uint16_t product;
+} kb_vp_t;
+
+static kb_vp_t kb_allow_ids[KB_VP_LIST_MAX];
+static size_t kb_allow_cunt = 0;
+static kb_vp_t kb_deny_ids[KB_VP_LIST_MAX];
+static size_t kb_deny_cunt = 0;
+
+// event timestamps come from the input core unless clock=ktime; both are CLOCK_MONOTONIC
 
-static int kb_ctrl_held = 0;
-static int kb_alt_held = 0;
+static int kb_ts_input __read_mostly = 1;
 
-static uint16_t kb_last_vendor = 0;
-static uint16_t kb_last_product = 0;
+// vendor << 16 | product of the device that spoke last; only stored when it changes
+
+static uint32_t kb_last_id = 0;
 
 // timer
 
-static struct timer_list kb_timer;
+static struct hrtimer kb_timer;
 static uint64_t kb_tick_cunt = 0;
+
+// set once the timer stops re-arming; the next event restarts it
+
+static int kb_idle __read_mostly = 0;
+static atomic_t kb_stream_cunt = ATOMIC_INIT(0);
 static uint64_t kb_init_ns = 0;
 
-static kb_bucket_t *kb_scratch_timer = NULL;
-static kb_bucket_t *kb_scratch_rd = NULL;
+// whole CLOCK_MONOTONIC second at or before load; second n of the rings ends at kb_tick_base_ns + n s
+
+static uint64_t kb_tick_base_ns = 0;
+
+// bytes of all tier arenas together, capped by max_kb
+
+static atomic64_t kb_arena_bytes = ATOMIC64_INIT(0);
+
+static struct workqueue_struct *kb_wq = NULL;
+static struct work_struct kb_work;
 
 // synchronization
 
-static DEFINE_SPINLOCK(kb_lock);
+static __cacheline_aligned_in_smp DEFINE_SPINLOCK(kb_lock);
+static seqcount_spinlock_t kb_snap_seq = SEQCNT_SPINLOCK_ZERO(kb_snap_seq, &kb_lock);
 static int kb_shutdown = 0;
 
-// input handler forward declarations
+// input handler forward declarations
+
+static int kb_connect(struct input_handler *handler, struct input_dev *dev, const struct input_device_id *id);
+static void kb_disconnect(struct input_handle *handle);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+static unsigned int kb_events(struct input_handle *handle, struct input_value *vals, unsigned int cunt);
+#else
+static void kb_events(struct input_handle *handle, const struct input_value *vals, unsigned int cunt);
+static void kb_event(struct input_handle *handle, unsigned int type, unsigned int code, int val);
+#endif
+
+// bucket operations
+
+static void kb_bucket_zero(kb_bucket_t *b)
+{
+    memset(b, 0, sizeof(*b));
+    b->shortest_gap_ns = U64_MAX;
+}
+
+static void kb_bucket_merge(kb_bucket_t *dst, const kb_bucket_t *src, int skip_perkey)
+{
+    size_t idx = 0;
+
+    dst->press_cunt = KB_SAT_ADD32(dst->press_cunt, src->press_cunt);
+    dst->release_cunt = KB_SAT_ADD32(dst->release_cunt, src->release_cunt);
+    dst->char_del_cunt = KB_SAT_ADD32(dst->char_del_cunt, src->char_del_cunt);
+    dst->word_del_cunt = KB_SAT_ADD32(dst->word_del_cunt, src->word_del_cunt);
+
+    for (idx = 0; idx < KB_KEY_CLASS_CUNT; idx++) { dst->class_cunt[idx] = KB_SAT_ADD32(dst->class_cunt[idx], src->class_cunt[idx]); }
+
+    dst->hold_sum_ns = KB_SAT_ADD64(dst->hold_sum_ns, src->hold_sum_ns);
+    dst->hold_cunt = KB_SAT_ADD32(dst->hold_cunt, src->hold_cunt);
+    kb_u128_add(&dst->hold_sumsq, src->hold_sumsq);
+
+    for (idx = 0; idx < KB_HIST_BIN_CUNT; idx++) { dst->hold_hist[idx] = KB_SAT_ADD32(dst->hold_hist[idx], src->hold_hist[idx]); }
+
+    if (src->peak_press_cunt > dst->peak_press_cunt) { dst->peak_press_cunt = src->peak_press_cunt; }
+
+    if (src->longest_hold_ns > dst->longest_hold_ns) { dst->longest_hold_ns = src->longest_hold_ns; }
+
+    dst->gap_sum_ns = KB_SAT_ADD64(dst->gap_sum_ns, src->gap_sum_ns);
+    dst->gap_cunt = KB_SAT_ADD32(dst->gap_cunt, src->gap_cunt);
+    kb_u128_add(&dst->gap_sumsq, src->gap_sumsq);
+
+    for (idx = 0; idx < KB_HIST_BIN_CUNT; idx++) { dst->gap_hist[idx] = KB_SAT_ADD32(dst->gap_hist[idx], src->gap_hist[idx]); }
+
+    if (src->shortest_gap_ns < dst->shortest_gap_ns) { dst->shortest_gap_ns = src->shortest_gap_ns; }
+
+    if (src->longest_gap_ns > dst->longest_gap_ns) { dst->longest_gap_ns = src->longest_gap_ns; }
+
+    if (!skip_perkey) { for (idx = 0; idx < KB_KEY_SLOT_CUNT; idx++) { dst->key_cunt[idx] = KB_SAT_ADD32(dst->key_cunt[idx], src->key_cunt[idx]); } }
+}
+
+static void kb_bucket_copy(kb_bucket_t *dst, const kb_bucket_t *src, int skip_perkey)
+{
+    if (skip_perkey) { memcpy(dst, src, offsetof(kb_bucket_t, key_cunt)); }
+    else { *dst = *src; }
+}
+
+// removes src's additive contribution from dst; extremes are left for the caller to rescan
+
+static void kb_bucket_unmerge(kb_bucket_t *dst, const kb_bucket_t *src, int skip_perkey)
+{
+    size_t idx = 0;
+
+    dst->press_cunt = KB_SAT_SUB(dst->press_cunt, src->press_cunt);
+    dst->release_cunt = KB_SAT_SUB(dst->release_cunt, src->release_cunt);
+    dst->char_del_cunt = KB_SAT_SUB(dst->char_del_cunt, src->char_del_cunt);
+    dst->word_del_cunt = KB_SAT_SUB(dst->word_del_cunt, src->word_del_cunt);
+
+    for (idx = 0; idx < KB_KEY_CLASS_CUNT; idx++) { dst->class_cunt[idx] = KB_SAT_SUB(dst->class_cunt[idx], src->class_cunt[idx]); }
+
+    kb_u128_sub(&dst->hold_sumsq, src->hold_sumsq);
+    for (idx = 0; idx < KB_HIST_BIN_CUNT; idx++) { dst->hold_hist[idx] = KB_SAT_SUB(dst->hold_hist[idx], src->hold_hist[idx]); }
+    dst->hold_sum_ns = KB_SAT_SUB(dst->hold_sum_ns, src->hold_sum_ns);
+    dst->hold_cunt = KB_SAT_SUB(dst->hold_cunt, src->hold_cunt);
+
+    kb_u128_sub(&dst->gap_sumsq, src->gap_sumsq);
+    for (idx = 0; idx < KB_HIST_BIN_CUNT; idx++) { dst->gap_hist[idx] = KB_SAT_SUB(dst->gap_hist[idx], src->gap_hist[idx]); }
+    dst->gap_sum_ns = KB_SAT_SUB(dst->gap_sum_ns, src->gap_sum_ns);
+    dst->gap_cunt = KB_SAT_SUB(dst->gap_cunt, src->gap_cunt);
+
+    if (!skip_perkey) { for (idx = 0; idx < KB_KEY_SLOT_CUNT; idx++) { dst->key_cunt[idx] = KB_SAT_SUB(dst->key_cunt[idx], src->key_cunt[idx]); } }
+}
+
+static void kb_kbd_live_fold(kb_kbd_t *k, kb_bucket_t *dst, int skip_perkey)
+{
+    unsigned long flags = 0;
+
+    spin_lock_irqsave(&k->lock, flags);
+    kb_bucket_merge(dst, &k->live, skip_perkey);
+    spin_unlock_irqrestore(&k->lock, flags);
+}
+
+// sums every device's live bucket into dst; caller holds kb_lock or rcu_read_lock()
+
+static void kb_live_fold(kb_bucket_t *dst, int skip_perkey)
+{
+    kb_kbd_t *k = NULL;
+
+    list_for_each_entry_rcu(k, &kb_kbds, node, lockdep_is_held(&kb_lock)) { kb_kbd_live_fold(k, dst, skip_perkey); }
+}
+
+static void kb_window_agg_init(kb_window_agg_t *w, size_t span, size_t bucket_secs)
+{
+    kb_bucket_zero(&w->acc);
+    w->span = span;
+    w->bucket_secs = bucket_secs;
+}
+
+// ring operations
+
+static inline kb_bucket_t *kb_ring_at(const kb_ring_t *r, size_t pos)
+{
+    return (kb_bucket_t *)(r->base + pos * r->stride);
+}
+
+static inline int kb_ring_perkey_is(const kb_ring_t *r)
+{
+    return r->stride == sizeof(kb_bucket_t);
+}
+
+// writes b at the head; the caller moves the head
+
+static void kb_ring_put(kb_ring_t *r, const kb_bucket_t *b)
+{
+    kb_bucket_copy(kb_ring_at(r, r->idx), b, !kb_ring_perkey_is(r));
+}
+
+// windows over a ring without per-key counts keep none either
+
+static void kb_window_slide(kb_window_agg_t *w, const kb_ring_t *r, const kb_bucket_t *incoming)
+{
+    size_t idx = 0;
+    size_t span = w->span;
+    size_t start = (r->idx + r->size - span) % r->size;
+    int skip_perkey = !kb_ring_perkey_is(r);
+
+    kb_bucket_unmerge(&w->acc, kb_ring_at(r, start), skip_perkey);
+    kb_bucket_merge(&w->acc, incoming, skip_perkey);
+
+    // extremes can't be subtracted; rescan the scalars of the slots that stay in the window
+
+    w->acc.longest_hold_ns = incoming->longest_hold_ns;
+    w->acc.shortest_gap_ns = incoming->shortest_gap_ns;
+    w->acc.longest_gap_ns = incoming->longest_gap_ns;
+    w->acc.peak_press_cunt = incoming->peak_press_cunt;
+
+    for (idx = 1; idx < span; idx++)
+    {
+        const kb_bucket_t *b = kb_ring_at(r, (start + idx) % r->size);
+
+        if (b->longest_hold_ns > w->acc.longest_hold_ns) { w->acc.longest_hold_ns = b->longest_hold_ns; }
+
+        if (b->shortest_gap_ns < w->acc.shortest_gap_ns) { w->acc.shortest_gap_ns = b->shortest_gap_ns; }
+
+        if (b->longest_gap_ns > w->acc.longest_gap_ns) { w->acc.longest_gap_ns = b->longest_gap_ns; }
+
+        if (b->peak_press_cunt > w->acc.peak_press_cunt) { w->acc.peak_press_cunt = b->peak_press_cunt; }
+    }
+}
+
+// range index
+
+static inline void kb_ext_neutral(kb_ext_t *e)
+{
+    memset(e, 0, sizeof(*e));
+    e->shortest_gap_ns = U64_MAX;
+}
+
+static inline void kb_ext_combine(kb_ext_t *dst, const kb_ext_t *src)
+{
+    if (src->longest_hold_ns > dst->longest_hold_ns) { dst->longest_hold_ns = src->longest_hold_ns; }
+
+    if (src->shortest_gap_ns < dst->shortest_gap_ns) { dst->shortest_gap_ns = src->shortest_gap_ns; }
+
+    if (src->longest_gap_ns > dst->longest_gap_ns) { dst->longest_gap_ns = src->longest_gap_ns; }
+
+    if (src->peak_press_cunt > dst->peak_press_cunt) { dst->peak_press_cunt = src->peak_press_cunt; }
+}
+
+static void kb_ext_query(kb_ext_t *res, const kb_ext_t *tree, size_t size, size_t l, size_t r)
+{
+    for (l += size, r += size; l < r; l >>= 1, r >>= 1)
+    {
+        if (l & 1) { kb_ext_combine(res, &tree[l++]); }
+
+        if (r & 1) { kb_ext_combine(res, &tree[--r]); }
+    }
+}
+
+// records b, just written at ring position pos; worker only
+
+static void kb_range_push(kb_tier_range_t *r, size_t size, size_t pos, const kb_bucket_t *b)
+{
+    const kb_prefix_t *prev = &r->prefix[r->pidx];
+    kb_prefix_t *cur = NULL;
+    kb_ext_t *leaf = NULL;
+    size_t idx = 0;
+
+    if (kb_bucket_idle_is(b))
+    {
+        if (r->flat > size)
+        {
+            r->pidx = (r->pidx + 1) % (size + 1);
+            return;
+        }
+
+        r->flat++;
+    }
+    else { r->flat = 0; }
+
+    r->pidx = (r->pidx + 1) % (size + 1);
+    cur = &r->prefix[r->pidx];
+
+    cur->press_cunt = prev->press_cunt + b->press_cunt;
+    cur->release_cunt = prev->release_cunt + b->release_cunt;
+    cur->char_del_cunt = prev->char_del_cunt + b->char_del_cunt;
+    cur->word_del_cunt = prev->word_del_cunt + b->word_del_cunt;
+    cur->hold_sum_ns = prev->hold_sum_ns + b->hold_sum_ns;
+    cur->hold_cunt = prev->hold_cunt + b->hold_cunt;
+    cur->hold_sumsq = prev->hold_sumsq;
+    kb_u128_add(&cur->hold_sumsq, b->hold_sumsq);
+    cur->gap_sum_ns = prev->gap_sum_ns + b->gap_sum_ns;
+    cur->gap_cunt = prev->gap_cunt + b->gap_cunt;
+    cur->gap_sumsq = prev->gap_sumsq;
+    kb_u128_add(&cur->gap_sumsq, b->gap_sumsq);
+
+    for (idx = 0; idx < KB_KEY_CLASS_CUNT; idx++) { cur->class_cunt[idx] = prev->class_cunt[idx] + b->class_cunt[idx]; }
+    for (idx = 0; idx < KB_HIST_BIN_CUNT; idx++) { cur->hold_hist[idx] = prev->hold_hist[idx] + b->hold_hist[idx]; }
+    for (idx = 0; idx < KB_HIST_BIN_CUNT; idx++) { cur->gap_hist[idx] = prev->gap_hist[idx] + b->gap_hist[idx]; }
+
+    leaf = &r->ext[size + pos];
+    leaf->longest_hold_ns = b->longest_hold_ns;
+    leaf->shortest_gap_ns = b->shortest_gap_ns;
+    leaf->longest_gap_ns = b->longest_gap_ns;
+    leaf->peak_press_cunt = b->peak_press_cunt;
+
+    for (idx = size + pos; idx > 1; idx >>= 1)
+    {
+        r->ext[idx >> 1] = r->ext[idx];
+        kb_ext_combine(&r->ext[idx >> 1], &r->ext[idx ^ 1]);
+    }
+}
+
+// n idle pushes from ring position pos; once flat only pidx moves
+
+static void kb_range_skip(kb_tier_range_t *r, size_t size, size_t pos, uint64_t n, const kb_bucket_t *idle)
+{
+    uint32_t rem = 0;
+
+    for (; n > 0 && r->flat <= size; n--)
+    {
+        kb_range_push(r, size, pos, idle);
+        pos = (pos + 1) % size;
+    }
+
+    div_u64_rem(n, size + 1, &rem);
+    r->pidx = (r->pidx + rem) % (size + 1);
+}
+
+// sums the len slots ending off slots before the newest into b; head is the ring's next write position
+
+static void kb_range_fold(kb_bucket_t *b, const kb_tier_range_t *r, size_t size, size_t head, size_t off, size_t len)
+{
+    const kb_prefix_t *hi = &r->prefix[(r->pidx + size + 1 - off) % (size + 1)];
+    const kb_prefix_t *lo = &r->prefix[(r->pidx + size + 1 - off - len) % (size + 1)];
+    size_t start = (head + size - off - len) % size;
+    kb_ext_t ext;
+    size_t idx = 0;
+
+    kb_bucket_zero(b);
+
+    b->press_cunt = (uint32_t)min_t(uint64_t, hi->press_cunt - lo->press_cunt, U32_MAX);
+    b->release_cunt = (uint32_t)min_t(uint64_t, hi->release_cunt - lo->release_cunt, U32_MAX);
+    b->char_del_cunt = (uint32_t)min_t(uint64_t, hi->char_del_cunt - lo->char_del_cunt, U32_MAX);
+    b->word_del_cunt = (uint32_t)min_t(uint64_t, hi->word_del_cunt - lo->word_del_cunt, U32_MAX);
+    b->hold_sum_ns = hi->hold_sum_ns - lo->hold_sum_ns;
+    b->hold_cunt = (uint32_t)min_t(uint64_t, hi->hold_cunt - lo->hold_cunt, U32_MAX);
+    b->hold_sumsq = hi->hold_sumsq;
+    kb_u128_sub(&b->hold_sumsq, lo->hold_sumsq);
+    b->gap_sum_ns = hi->gap_sum_ns - lo->gap_sum_ns;
+    b->gap_cunt = (uint32_t)min_t(uint64_t, hi->gap_cunt - lo->gap_cunt, U32_MAX);
+    b->gap_sumsq = hi->gap_sumsq;
+    kb_u128_sub(&b->gap_sumsq, lo->gap_sumsq);
+
+    for (idx = 0; idx < KB_KEY_CLASS_CUNT; idx++) { b->class_cunt[idx] = (uint32_t)min_t(uint64_t, hi->class_cunt[idx] - lo->class_cunt[idx], U32_MAX); }
+    for (idx = 0; idx < KB_HIST_BIN_CUNT; idx++) { b->hold_hist[idx] = hi->hold_hist[idx] - lo->hold_hist[idx]; }
+    for (idx = 0; idx < KB_HIST_BIN_CUNT; idx++) { b->gap_hist[idx] = hi->gap_hist[idx] - lo->gap_hist[idx]; }
+
+    kb_ext_neutral(&ext);
+
+    if (start + len <= size) { kb_ext_query(&ext, r->ext, size, start, start + len); }
+    else
+    {
+        kb_ext_query(&ext, r->ext, size, start, size);
+        kb_ext_query(&ext, r->ext, size, 0, start + len - size);
+    }
+
+    b->longest_hold_ns = ext.longest_hold_ns;
+    b->shortest_gap_ns = ext.shortest_gap_ns;
+    b->longest_gap_ns = ext.longest_gap_ns;
+    b->peak_press_cunt = ext.peak_press_cunt;
+}
+
+static void kb_tiers_free(kb_tiers_t *t)
+{
+    if (t->arena) { atomic64_sub((s64)t->arena_size, &kb_arena_bytes); }
+
+    kvfree(t->arena);
+    memset(t, 0, sizeof(*t));
+}
+
+// cache-line aligned bump allocator over base; with base NULL it only counts
+
+static void *kb_arena_take(char *base, size_t *off, size_t bytes)
+{
+    void *p = base ? (base + *off) : NULL;
+
+    *off = ALIGN(*off + bytes, SMP_CACHE_BYTES);
+    return p;
+}
+
+static size_t kb_tiers_carve(kb_tiers_t *t, char *base, int glob)
+{
+    kb_prefix_t *prefix = NULL;
+    kb_ext_t *ext = NULL;
+    size_t off = 0;
+    size_t tier = 0;
+
+    for (tier = 0; tier < KB_TIER_CUNT; tier++)
+    {
+        t->rings[tier].size = *kb_tier_descs[tier].kept;
+        t->rings[tier].stride = (kb_perkey_tiers & BIT(tier)) ? sizeof(kb_bucket_t) : ALIGN(offsetof(kb_bucket_t, key_cunt), __alignof__(kb_bucket_t));
+        t->rings[tier].base = kb_arena_take(base, &off, t->rings[tier].size * t->rings[tier].stride);
+    }
+
+    t->pend = kb_arena_take(base, &off, (KB_TIER_CUNT - 1) * sizeof(kb_bucket_t));
+    t->closed = kb_arena_take(base, &off, 2 * sizeof(kb_bucket_t));
+    t->windows = kb_arena_take(base, &off, KB_WINDOW_CUNT * sizeof(kb_window_agg_t));
+    t->snap = kb_arena_take(base, &off, KB_WINDOW_CUNT * sizeof(kb_window_agg_t));
+
+    if (!glob) { return off; }
+
+    t->ranges = kb_arena_take(base, &off, KB_TIER_CUNT * sizeof(kb_tier_range_t));
+    t->scratch = kb_arena_take(base, &off, sizeof(kb_bucket_t));
+
+    for (tier = 0; tier < KB_TIER_CUNT; tier++)
+    {
+        prefix = kb_arena_take(base, &off, (t->rings[tier].size + 1) * sizeof(kb_prefix_t));
+        ext = kb_arena_take(base, &off, 2 * t->rings[tier].size * sizeof(kb_ext_t));
+
+        if (t->ranges)
+        {
+            t->ranges[tier].prefix = prefix;
+            t->ranges[tier].ext = ext;
+        }
+    }
+
+    return off;
+}
+
+static int kb_tiers_alloc(kb_tiers_t *t, uint64_t born_ns, int glob)
+{
+    const kb_window_desc_t *d = NULL;
+    size_t size = 0;
+    size_t idx = 0;
+    size_t tier = 0;
+
+    memset(t, 0, sizeof(*t));
+
+    size = kb_tiers_carve(t, NULL, glob);
+
+    if (unlikely(atomic64_add_return((s64)size, &kb_arena_bytes) > (s64)kb_max_kb * 1024))
+    {
+        atomic64_sub((s64)size, &kb_arena_bytes);
+        return -ENOMEM;
+    }
+
+    t->arena = kvzalloc(size, GFP_KERNEL);
+    if (unlikely(!t->arena))
+    {
+        atomic64_sub((s64)size, &kb_arena_bytes);
+        return -ENOMEM;
+    }
+
+    t->arena_size = size;
+
+    kb_tiers_carve(t, t->arena, glob);
+
+    for (tier = 0; tier < KB_TIER_CUNT; tier++) { for (idx = 0; idx < t->rings[tier].size; idx++) { kb_ring_at(&t->rings[tier], idx)->shortest_gap_ns = U64_MAX; } }
+
+    if (t->ranges) { for (tier = 0; tier < KB_TIER_CUNT; tier++) { for (idx = 0; idx < 2 * t->rings[tier].size; idx++) { kb_ext_neutral(&t->ranges[tier].ext[idx]); } } }
+
+    if (t->scratch) { kb_bucket_zero(t->scratch); }
+
+    for (idx = 0; idx < KB_TIER_CUNT - 1; idx++) { kb_bucket_zero(&t->pend[idx]); }
+    for (idx = 0; idx < 2; idx++) { kb_bucket_zero(&t->closed[idx]); }
+
+    // spans are cut to the ring here; kb_window_slide relies on it
+
+    for (idx = 0; idx < KB_WINDOW_CUNT; idx++)
+    {
+        d = &kb_window_descs[idx];
+        kb_window_agg_init(&t->windows[idx], d->span ? min_t(size_t, d->span, t->rings[d->tier].size) : t->rings[d->tier].size, kb_tier_descs[d->tier].secs);
+    }
+
+    memcpy(t->snap, t->windows, KB_WINDOW_CUNT * sizeof(kb_window_agg_t));
+
+    t->born_ns = born_ns;
+    return 0;
+}
+
+// rates over the window's duration, capped at the uptime; live adds the time since the last processed second
+
+static void kb_window_rates_fill(kb_window_stats_t *w, const kb_window_agg_t *agg, int live, uint64_t live_ns, uint64_t uptime_ns)
+{
+    uint64_t duration_ns = (uint64_t)agg->span * agg->bucket_secs * NSEC_PER_SEC;
+
+    if (live) { duration_ns += live_ns; }
+
+    if (duration_ns > uptime_ns) { duration_ns = uptime_ns; }
+
+    w->avg_kps = (duration_ns > 0) ? mul_u64_u64_div_u64(w->keystroke_cunt, 1000 * NSEC_PER_SEC, duration_ns) : 0;
+    w->avg_cps = (duration_ns > 0) ? mul_u64_u64_div_u64(w->char_cunt, 1000 * NSEC_PER_SEC, duration_ns) : 0;
+}
+
+static void kb_window_stats_fill(kb_window_stats_t *w, const kb_window_agg_t *agg, const kb_bucket_t *live_bucket, uint64_t live_ns, uint64_t uptime_ns, kb_bucket_t *acc, uint32_t fields)
+{
+    int skip_perkey = !(fields & KB_QUERY_PERKEY);
+    size_t idx = 0;
+
+    kb_bucket_copy(acc, &agg->acc, skip_perkey);
+
+    if (live_bucket) { kb_bucket_merge(acc, live_bucket, skip_perkey); }
+
+    if (fields & KB_QUERY_SCALAR)
+    {
+        w->keystroke_cunt = acc->press_cunt;
+        w->release_cunt = acc->release_cunt;
+        w->char_cunt = acc->class_cunt[KB_KEY_CLASS_PRINTABLE];
+        w->char_del_cunt = acc->char_del_cunt;
+        w->word_del_cunt = acc->word_del_cunt;
+        w->longest_hold_ns = acc->longest_hold_ns;
+        w->shortest_gap_ns = (acc->shortest_gap_ns == U64_MAX) ? 0 : acc->shortest_gap_ns;
+        w->longest_gap_ns = acc->longest_gap_ns;
+        w->avg_hold_ns = (acc->hold_cunt > 0) ? (acc->hold_sum_ns / acc->hold_cunt) : 0;
+        w->hold_var_ns = kb_var_ns(acc->hold_sum_ns, acc->hold_sumsq, acc->hold_cunt);
+        w->avg_gap_ns = (acc->gap_cunt > 0) ? (acc->gap_sum_ns / acc->gap_cunt) : 0;
+        w->gap_var_ns = kb_var_ns(acc->gap_sum_ns, acc->gap_sumsq, acc->gap_cunt);
+        w->hold_p50_ns = kb_hist_pct_ns(acc->hold_hist, 50, acc->longest_hold_ns);
+        w->hold_p90_ns = kb_hist_pct_ns(acc->hold_hist, 90, acc->longest_hold_ns);
+        w->hold_p99_ns = kb_hist_pct_ns(acc->hold_hist, 99, acc->longest_hold_ns);
+        w->gap_p50_ns = kb_hist_pct_ns(acc->gap_hist, 50, acc->longest_gap_ns);
+        w->gap_p90_ns = kb_hist_pct_ns(acc->gap_hist, 90, acc->longest_gap_ns);
+        w->gap_p99_ns = kb_hist_pct_ns(acc->gap_hist, 99, acc->longest_gap_ns);
+        kb_window_rates_fill(w, agg, live_bucket != NULL, live_ns, uptime_ns);
+        w->peak_kps = (uint64_t)acc->peak_press_cunt * 1000;
+
+        for (idx = 0; idx < KB_KEY_CLASS_CUNT; idx++) { w->class_cunt[idx] = acc->class_cunt[idx]; }
+    }
+    else { memset(w, 0, offsetof(kb_window_stats_t, per_key_cunt)); }
+
+    if (!skip_perkey)
+    {
+        memset(w->per_key_cunt, 0, sizeof(w->per_key_cunt));
+        for (idx = 0; idx < KB_KEY_DIRECT_CUNT; idx++) { w->per_key_cunt[idx] = acc->key_cunt[idx]; }
+        for (idx = 0; idx < ARRAY_SIZE(kb_key_extra); idx++) { w->per_key_cunt[kb_key_extra[idx]] = acc->key_cunt[KB_KEY_DIRECT_CUNT + idx]; }
+    }
+}
+
+static int kb_root_is(void)
+{
+    return uid_eq(current_uid(), GLOBAL_ROOT_UID) || uid_eq(current_euid(), GLOBAL_ROOT_UID);
+}
+
+static void kb_window_stats_pub_from(kb_window_stats_pub_t *pub, const kb_window_stats_t *w)
+{
+    pub->keystroke_cunt = w->keystroke_cunt;
+    pub->release_cunt = w->release_cunt;
+    pub->char_cunt = w->char_cunt;
+    pub->char_del_cunt = w->char_del_cunt;
+    pub->word_del_cunt = w->word_del_cunt;
+    pub->avg_kps = w->avg_kps;
+    pub->avg_cps = w->avg_cps;
+    pub->peak_kps = w->peak_kps;
+    pub->avg_hold_ns = w->avg_hold_ns;
+    pub->hold_var_ns = w->hold_var_ns;
+    pub->longest_hold_ns = w->longest_hold_ns;
+    pub->avg_gap_ns = w->avg_gap_ns;
+    pub->gap_var_ns = w->gap_var_ns;
+    pub->shortest_gap_ns = w->shortest_gap_ns;
+    pub->longest_gap_ns = w->longest_gap_ns;
+    pub->hold_p50_ns = w->hold_p50_ns;
+    pub->hold_p90_ns = w->hold_p90_ns;
+    pub->hold_p99_ns = w->hold_p99_ns;
+    pub->gap_p50_ns = w->gap_p50_ns;
+    pub->gap_p90_ns = w->gap_p90_ns;
+    pub->gap_p99_ns = w->gap_p99_ns;
+    memcpy(pub->class_cunt, w->class_cunt, sizeof(pub->class_cunt));
+}
+
+static void kb_stats_pub_from(kb_stats_pub_t *pub, const kb_stats_t *stats)
+{
+    size_t i = 0;
+
+    memset(pub, 0, sizeof(*pub));
+    pub->uptime_ns = stats->uptime_ns;
+    pub->last_vendor = stats->last_vendor;
+    pub->last_product = stats->last_product;
+
+    for (i = 0; i < KB_WINDOW_CUNT; i++) { kb_window_stats_pub_from(&pub->windows[i], &stats->windows[i]); }
+}
+
+static void kb_tick_rec_fill(kb_tick_rec_t *rec, const kb_bucket_t *b, uint64_t tick)
+{
+    memset(rec, 0, sizeof(*rec));
+    rec->tick = tick;
+    rec->press_cunt = b->press_cunt;
+    rec->release_cunt = b->release_cunt;
+    rec->char_cunt = b->class_cunt[KB_KEY_CLASS_PRINTABLE];
+    rec->char_del_cunt = b->char_del_cunt;
+    rec->word_del_cunt = b->word_del_cunt;
+    rec->hold_cunt = b->hold_cunt;
+    rec->gap_cunt = b->gap_cunt;
+    rec->peak_press_cunt = b->peak_press_cunt;
+    rec->hold_sum_ns = b->hold_sum_ns;
+    rec->hold_var_ns = kb_var_ns(b->hold_sum_ns, b->hold_sumsq, b->hold_cunt);
+    rec->longest_hold_ns = b->longest_hold_ns;
+    rec->gap_sum_ns = b->gap_sum_ns;
+    rec->gap_var_ns = kb_var_ns(b->gap_sum_ns, b->gap_sumsq, b->gap_cunt);
+    rec->shortest_gap_ns = (b->shortest_gap_ns == U64_MAX) ? 0 : b->shortest_gap_ns;
+    rec->longest_gap_ns = b->longest_gap_ns;
+}
+
+// fills out[], or pub[] through out[0], from t's snapshot plus the live and closed buckets; k NULL means kb_glob
+
+static void kb_snap_windows_fill(const kb_tiers_t *t, kb_kbd_t *k, kb_window_stats_t *out, kb_window_stats_pub_t *pub, uint32_t window_mask, uint32_t fields, kb_bucket_t *scratch, uint64_t *uptime_ns)
+{
+    int skip_perkey = !(fields & KB_QUERY_PERKEY);
+    unsigned int seq = 0;
+    size_t idx = 0;
+    size_t pos = 0;
+    uint64_t now = 0;
+    uint64_t live_ns = 0;
+
+    rcu_read_lock();
+
+    do
+    {
+        seq = read_seqcount_begin(&kb_snap_seq);
+
+        now = ktime_get_ns();
+        *uptime_ns = now - t->born_ns;
+
+        // closed-but-unprocessed seconds are folded with the live buckets, so they count as live time
+
+        live_ns = KB_SAT_SUB(now, kb_tick_base_ns + kb_tick_cunt * NSEC_PER_SEC);
+
+        kb_bucket_zero(&scratch[0]);
+
+        if (k) { kb_kbd_live_fold(k, &scratch[0], skip_perkey); }
+        else { kb_live_fold(&scratch[0], skip_perkey); }
+
+        kb_bucket_merge(&scratch[0], &t->closed[0], skip_perkey);
+        kb_bucket_merge(&scratch[0], &t->closed[1], skip_perkey);
+
+        for (idx = 0, pos = 0; idx < KB_WINDOW_CUNT; idx++)
+        {
+            if (!(window_mask & (1U << idx))) { continue; }
+
+            if (pub)
+            {
+                kb_window_stats_fill(&out[0], &t->snap[idx], &scratch[0], live_ns, *uptime_ns, &scratch[1], fields);
+                kb_window_stats_pub_from(&pub[pos++], &out[0]);
+            }
+            else { kb_window_stats_fill(&out[pos++], &t->snap[idx], &scratch[0], live_ns, *uptime_ns, &scratch[1], fields); }
+        }
+    } while (read_seqcount_retry(&kb_snap_seq, seq));
+
+    rcu_read_unlock();
+}
+
+// rewrites both mapped regions; from the worker, or init before the timer starts
+
+static void kb_map_refresh(kb_bucket_t *acc)
+{
+    kb_stats_t *full = &kb_map_full->stats;
+    uint32_t last_id = 0;
+    uint32_t tier = 0;
+    size_t idx = 0;
+
+    WRITE_ONCE(kb_map_full->seq, kb_map_full->seq + 1);
+    WRITE_ONCE(kb_map_pub->seq, kb_map_pub->seq + 1);
+    smp_wmb();
+
+    full->uptime_ns = ktime_get_ns() - kb_init_ns;
+    last_id = READ_ONCE(kb_last_id);
+    full->last_vendor = (uint16_t)(last_id >> 16);
+    full->last_product = (uint16_t)last_id;
+
+    for (idx = 0; idx < KB_WINDOW_CUNT; idx++)
+    {
+        tier = kb_window_descs[idx].tier;
+
+        if (kb_glob.gen[tier] != kb_map_gen[tier]) { kb_window_stats_fill(&full->windows[idx], &kb_glob.windows[idx], NULL, 0, full->uptime_ns, acc, KB_QUERY_FIELDS_ALL); }
+        else { kb_window_rates_fill(&full->windows[idx], &kb_glob.windows[idx], 0, 0, full->uptime_ns); }
+    }
+
+    memcpy(kb_map_gen, kb_glob.gen, sizeof(kb_map_gen));
+
+    kb_stats_pub_from(&kb_map_pub->stats, full);
+
+    smp_wmb();
+    WRITE_ONCE(kb_map_full->seq, kb_map_full->seq + 1);
+    WRITE_ONCE(kb_map_pub->seq, kb_map_pub->seq + 1);
+}
+
+// tick worker
+
+// slides tier's windows over b and stores it; without store only the head and range index move
+
+static void kb_tier_close(kb_tiers_t *t, uint32_t tier, const kb_bucket_t *b, int store)
+{
+    kb_ring_t *r = &t->rings[tier];
+    size_t idx = 0;
+
+    if (store)
+    {
+        for (idx = 0; idx < KB_WINDOW_CUNT; idx++) { if (kb_window_descs[idx].tier == tier) { kb_window_slide(&t->windows[idx], r, b); } }
+
+        kb_ring_put(r, b);
+        t->gen[tier]++;
+    }
+
+    if (t->ranges) { kb_range_push(&t->ranges[tier], r->size, r->idx, b); }
+
+    r->idx = (r->idx + 1) % r->size;
+}
+
+// pushes one closed second through t's tiers; worker only
+static void kb_tier_advance(kb_tiers_t *t, const kb_bucket_t *sec, uint64_t tick)
+{
+    uint32_t tier = kb_tier_descs[0].parent;
+    uint32_t parent = 0;
+    uint32_t rem = 0;
+    int store = 0;
+
+    // window 0 spans the whole seconds ring, so once it is empty an idle second only moves the head
+
+    store = !kb_bucket_idle_is(sec) || !kb_bucket_idle_is(&t->windows[0].acc);
+    kb_tier_close(t, 0, sec, store);
+
+    if (store && tier != KB_TIER_NONE) { kb_bucket_merge(&t->pend[tier - 1], sec, 0); }
+
+    // a tier only closes on ticks its children close on too, so the walk stops at the first that doesn't
+
+    while (tier != KB_TIER_NONE)
+    {
+        div_u64_rem(tick, kb_tier_descs[tier].secs, &rem);
+        if (rem != 0) { break; }
+
+        parent = kb_tier_descs[tier].parent;
+        kb_tier_close(t, tier, &t->pend[tier - 1], 1);
+
+        if (parent != KB_TIER_NONE) { kb_bucket_merge(&t->pend[parent - 1], &t->pend[tier - 1], 0); }
+
+        kb_bucket_zero(&t->pend[tier - 1]);
+        tier = parent;
+    }
+}
+
+// copies the windows whose tier moved since the last publish into snap; under kb_snap_seq
+
+static void kb_tiers_publish(kb_tiers_t *t)
+{
+    uint32_t tier = 0;
+    size_t idx = 0;
+
+    for (idx = 0; idx < KB_WINDOW_CUNT; idx++)
+    {
+        tier = kb_window_descs[idx].tier;
+        if (t->gen[tier] != t->snap_gen[tier]) { t->snap[idx] = t->windows[idx]; }
+    }
+
+    memcpy(t->snap_gen, t->gen, sizeof(t->gen));
+}
+
+// moves tier's head over n idle slots; only valid while the whole ring is idle
+
+static void kb_tier_skip(kb_tiers_t *t, uint32_t tier, uint64_t n)
+{
+    kb_ring_t *r = &t->rings[tier];
+    uint32_t rem = 0;
+
+    if (t->ranges) { kb_range_skip(&t->ranges[tier], r->size, r->idx, n, t->scratch); }
+
+    div_u64_rem(n, r->size, &rem);
+    r->idx = (r->idx + rem) % r->size;
+}
+
+// rolls secs seconds out of closed[half]; kb_glob.scratch must be zeroed. idle runs skip to the next parent boundary
+
+static void kb_tiers_drain(kb_tiers_t *t, size_t half, uint64_t secs)
+{
+    uint32_t parent = kb_tier_descs[0].parent;
+    uint64_t tick = kb_tick_cunt;
+    uint64_t end = kb_tick_cunt + secs;
+    uint64_t run = 0;
+    uint32_t rem = 0;
+
+    kb_tier_advance(t, &t->closed[half], ++tick);
+
+    while (tick < end)
+    {
+        if (kb_bucket_idle_is(&t->windows[0].acc))
+        {
+            run = end - tick;
+
+            if (parent != KB_TIER_NONE)
+            {
+                div_u64_rem(tick, kb_tier_descs[parent].secs, &rem);
+                run = min_t(uint64_t, run, kb_tier_descs[parent].secs - rem - 1);
+            }
+
+            kb_tier_skip(t, 0, run);
+            tick += run;
+
+            if (tick == end) { break; }
+        }
+
+        kb_tier_advance(t, kb_glob.scratch, ++tick);
+        cond_resched();
+    }
+}
+
+// kb_kbd_mutex keeps devices from coming or going while their tiers roll up
+
+static void kb_work_fn(struct work_struct *work)
+{
+    unsigned long flags = 0;
+    kb_bucket_t *closed = NULL;
+    kb_kbd_t *k = NULL;
+    uint64_t secs = 0;
+    uint64_t tick = 0;
+    uint64_t idx = 0;
+    size_t old = 0;
+
+    mutex_lock(&kb_kbd_mutex);
+
+    spin_lock_irqsave(&kb_lock, flags);
+    old = kb_closed_cur;
+    kb_closed_cur ^= 1;
+    secs = kb_closed_secs[old];
+    spin_unlock_irqrestore(&kb_lock, flags);
+
+    if (secs == 0)
+    {
+        mutex_unlock(&kb_kbd_mutex);
+        return;
+    }
+
+    closed = &kb_glob.closed[old];
+    kb_bucket_zero(kb_glob.scratch);
+
+    kb_tiers_drain(&kb_glob, old, secs);
+    list_for_each_entry(k, &kb_kbds, node) { if (k->tiers.arena) { kb_tiers_drain(&k->tiers, old, secs); } }
+
+    spin_lock_irqsave(&kb_lock, flags);
+    write_seqcount_begin(&kb_snap_seq);
+
+    kb_tiers_publish(&kb_glob);
+
+    list_for_each_entry(k, &kb_kbds, node)
+    {
+        if (!k->tiers.arena) { continue; }
+
+        kb_tiers_publish(&k->tiers);
+        kb_bucket_zero(&k->tiers.closed[old]);
+    }
+
+    for (idx = (secs > KB_TICK_REC_RING_SIZE) ? (secs - KB_TICK_REC_RING_SIZE) : 0; idx < secs; idx++)
+    {
+        tick = kb_tick_cunt + idx + 1;
+        kb_tick_rec_fill(&kb_tick_recs[tick % KB_TICK_REC_RING_SIZE], (idx == 0) ? closed : kb_glob.scratch, tick);
+    }
+
+    kb_tick_cunt += secs;
+    kb_bucket_zero(closed);
+    kb_closed_secs[old] = 0;
+
+    write_seqcount_end(&kb_snap_seq);
+    spin_unlock_irqrestore(&kb_lock, flags);
+
+    mutex_unlock(&kb_kbd_mutex);
+
+    kb_map_refresh(kb_glob.scratch);
+
+    wake_up_interruptible(&kb_tick_wq);
+}
+
+// the rings are time-driven: second n closes at kb_tick_base_ns + n s, however late the timer or worker runs
+
+static uint64_t kb_tick_target(uint64_t now)
+{
+    return div_u64(now - kb_tick_base_ns, NSEC_PER_SEC);
+}
+
+// absolute expiry of the next boundary, so late callbacks never push later ticks back
+
+static ktime_t kb_tick_next(uint64_t now)
+{
+    return ns_to_ktime(kb_tick_base_ns + (kb_tick_target(now) + 1) * NSEC_PER_SEC);
+}
+
+// books the seconds elapsed since the last close; caller holds kb_lock, nonzero if the worker has work
+
+static int kb_catch_up(uint64_t now)
+{
+    uint64_t target = kb_tick_target(now);
+    uint64_t seen = kb_tick_cunt + kb_closed_secs[0] + kb_closed_secs[1];
+    kb_kbd_t *k = NULL;
+
+    if (target <= seen) { return 0; }
+
+    write_seqcount_begin(&kb_snap_seq);
+
+    list_for_each_entry_rcu(k, &kb_kbds, node, lockdep_is_held(&kb_lock))
+    {
+        spin_lock(&k->lock);
+        if (k->tiers.arena) { kb_bucket_merge(&k->tiers.closed[kb_closed_cur], &k->live, 0); }
+        kb_bucket_merge(&kb_glob.closed[kb_closed_cur], &k->live, 0);
+        kb_bucket_zero(&k->live);
+        spin_unlock(&k->lock);
+    }
+
+    kb_closed_secs[kb_closed_cur] += target - seen;
+    write_seqcount_end(&kb_snap_seq);
+
+    return 1;
+}
+
+// caller holds kb_lock
+
+static int kb_live_pending(void)
+{
+    kb_kbd_t *k = NULL;
+    int pending = 0;
+
+    list_for_each_entry_rcu(k, &kb_kbds, node, lockdep_is_held(&kb_lock))
+    {
+        spin_lock(&k->lock);
+        pending = !kb_bucket_idle_is(&k->live);
+        spin_unlock(&k->lock);
+
+        if (pending) { break; }
+    }
+
+    return pending;
+}
+
+// timer callback; only closes the live buckets, the worker does the rest
+
+static enum hrtimer_restart kb_timer_cb(struct hrtimer *t)
+{
+    unsigned long flags = 0;
+    uint64_t now = ktime_get_ns();
+    enum hrtimer_restart restart = HRTIMER_NORESTART;
+
+    spin_lock_irqsave(&kb_lock, flags);
+
+    if (READ_ONCE(kb_shutdown))
+    {
+        spin_unlock_irqrestore(&kb_lock, flags);
+        return HRTIMER_NORESTART;
+    }
+
+    if (kb_catch_up(now)) { queue_work(kb_wq, &kb_work); }
+
+    // go idle once the seconds window is empty; kb_idle is raised before live is checked under each k->lock
+
+    if (kb_bucket_idle_is(&kb_glob.closed[0]) && kb_bucket_idle_is(&kb_glob.closed[1]) && kb_bucket_idle_is(&kb_glob.snap[0].acc) && atomic_read(&kb_stream_cunt) == 0)
+    {
+        WRITE_ONCE(kb_idle, 1);
+        if (kb_live_pending()) { WRITE_ONCE(kb_idle, 0); }
+    }
+
+    if (!kb_idle)
+    {
+        hrtimer_set_expires(t, kb_tick_next(now));
+        restart = HRTIMER_RESTART;
+    }
+
+    spin_unlock_irqrestore(&kb_lock, flags);
+
+    return restart;
+}
+
+// catches the rings up after idle; rearm restarts the tick. safe from the event path
+
+static void kb_wake(uint64_t now, int rearm)
+{
+    unsigned long flags = 0;
+
+    spin_lock_irqsave(&kb_lock, flags);
+
+    if (unlikely(READ_ONCE(kb_shutdown)))
+    {
+        spin_unlock_irqrestore(&kb_lock, flags);
+        return;
+    }
+
+    if (kb_catch_up(now)) { queue_work(kb_wq, &kb_work); }
+
+    if (rearm && kb_idle)
+    {
+        WRITE_ONCE(kb_idle, 0);
+        hrtimer_start(&kb_timer, kb_tick_next(now), HRTIMER_MODE_ABS_SOFT);
+    }
+
+    spin_unlock_irqrestore(&kb_lock, flags);
+}
+
+// brings the snapshot up to date before a read while the tick is stopped; process context only
+
+static void kb_sync(void)
+{
+    if (!READ_ONCE(kb_idle)) { return; }
+
+    kb_wake(ktime_get_ns(), 0);
+    flush_work(&kb_work);
+}
+
+// character device
+
+static int kb_dev_open(struct inode *inode, struct file *file)
+{
+    kb_file_t *f = NULL;
+    size_t size = sizeof(kb_stats_pub_t) + sizeof(kb_window_stats_t);
+
+    f = kzalloc(sizeof(kb_file_t), GFP_KERNEL);
+    if (unlikely(!f)) { return -ENOMEM; }
+
+    f->root = kb_root_is();
+    if (f->root) { size = max(size, sizeof(kb_stats_t)); }
+
+    f->scratch = kvzalloc(2 * sizeof(kb_bucket_t) + size, GFP_KERNEL);
+    if (unlikely(!f->scratch))
+    {
+        kfree(f);
+        return -ENOMEM;
+    }
+
+    f->stats = f->scratch + 2;
+    mutex_init(&f->lock);
+
+    file->private_data = f;
+    return 0;
+}
+
+static int kb_tick_avail(const kb_file_t *f)
+{
+    return READ_ONCE(kb_tick_cunt) >= READ_ONCE(f->next_tick);
+}
+
+static ssize_t kb_dev_stream_rd(kb_file_t *f, struct file *file, char __user *buff, size_t len)
+{
+    kb_tick_rec_t rec;
+    uint64_t latest = 0;
+    unsigned int seq = 0;
+    size_t done = 0;
+    int err = 0;
+
+    if (unlikely(len < sizeof(kb_tick_rec_t))) { return -EINVAL; }
+
+    while (!kb_tick_avail(f))
+    {
+        if (file->f_flags & O_NONBLOCK) { return -EAGAIN; }
+
+        err = wait_event_interruptible(kb_tick_wq, kb_tick_avail(f) || READ_ONCE(kb_shutdown));
+        if (unlikely(err)) { return err; }
+
+        if (unlikely(READ_ONCE(kb_shutdown))) { return -ENODEV; }
+    }
+
+    // next_tick is the fd's, shared with other threads reading or toggling it
+
+    err = mutex_lock_interruptible(&f->lock);
+    if (unlikely(err)) { return err; }
+
+    while (done + sizeof(kb_tick_rec_t) <= len)
+    {
+        do
+        {
+            seq = read_seqcount_begin(&kb_snap_seq);
+            latest = kb_tick_cunt;
+
+            if (f->next_tick + KB_TICK_REC_RING_SIZE <= latest) { WRITE_ONCE(f->next_tick, latest - KB_TICK_REC_RING_SIZE + 1); }
+
+            if (f->next_tick <= latest) { rec = kb_tick_recs[f->next_tick % KB_TICK_REC_RING_SIZE]; }
+        } while (read_seqcount_retry(&kb_snap_seq, seq));
+
+        if (f->next_tick > latest) { break; }
+
+        if (unlikely(copy_to_user(buff + done, &rec, sizeof(rec))))
+        {
+            mutex_unlock(&f->lock);
+            return done ? (ssize_t)done : -EFAULT;
+        }
+
+        WRITE_ONCE(f->next_tick, f->next_tick + 1);
+        done += sizeof(rec);
+    }
+
+    mutex_unlock(&f->lock);
+    return done;
+}
+
+// full stats need root both at open, which sized the buffer, and now
+
+static ssize_t kb_dev_rd(struct file *file, char __user *buff, size_t len, loff_t *off)
+{
+    kb_file_t *f = file->private_data;
+    kb_stats_t *stats = NULL;
+    kb_stats_pub_t *pub = NULL;
+    uint32_t last_id = 0;
+    int full = f->root && kb_root_is();
+    size_t out_size = full ? sizeof(kb_stats_t) : sizeof(kb_stats_pub_t);
+    ssize_t ret = 0;
+
+    if (f->stream) { return kb_dev_stream_rd(f, file, buff, len); }
+
+    if (unlikely(*off > 0)) { return 0; }
+
+    if (unlikely(len < out_size)) { return -EINVAL; }
+
+    if (unlikely(READ_ONCE(kb_shutdown))) { return -ENODEV; }
+
+    ret = mutex_lock_interruptible(&f->lock);
+    if (unlikely(ret)) { return ret; }
+
+    last_id = READ_ONCE(kb_last_id);
+    kb_sync();
+    WRITE_ONCE(f->next_tick, READ_ONCE(kb_tick_cunt) + 1);
+
+    if (full)
+    {
+        stats = f->stats;
+        stats->last_vendor = (uint16_t)(last_id >> 16);
+        stats->last_product = (uint16_t)last_id;
+        kb_snap_windows_fill(&kb_glob, NULL, stats->windows, NULL, KB_WINDOW_MASK_ALL, KB_QUERY_FIELDS_ALL, f->scratch, &stats->uptime_ns);
+    }
+    else
+    {
+        pub = f->stats;
+        pub->last_vendor = (uint16_t)(last_id >> 16);
+        pub->last_product = (uint16_t)last_id;
+        kb_snap_windows_fill(&kb_glob, NULL, (kb_window_stats_t *)(pub + 1), pub->windows, KB_WINDOW_MASK_ALL, KB_QUERY_SCALAR, f->scratch, &pub->uptime_ns);
+    }
+
+    ret = unlikely(copy_to_user(buff, f->stats, out_size)) ? -EFAULT : (ssize_t)out_size;
+
+    mutex_unlock(&f->lock);
+
+    if (ret > 0) { *off += out_size; }
+
+    return ret;
+}
+
+static int kb_dev_mmap(struct file *file, struct vm_area_struct *vma)
+{
+    unsigned long size = vma->vm_end - vma->vm_start;
+    void *area = NULL;
+    size_t area_size = 0;
+
+    if (unlikely(vma->vm_flags & VM_WRITE)) { return -EPERM; }
+
+    if (vma->vm_pgoff == 0)
+    {
+        area = kb_map_pub;
+        area_size = sizeof(kb_map_pub_t);
+    }
+    else if (vma->vm_pgoff == (KB_MAP_FULL_OFF >> PAGE_SHIFT))
+    {
+        if (unlikely(!kb_root_is())) { return -EPERM; }
+
+        area = kb_map_full;
+        area_size = sizeof(kb_map_t);
+    }
+    else { return -EINVAL; }
+
+    if (unlikely(size > PAGE_ALIGN(area_size))) { return -EINVAL; }
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+    vm_flags_clear(vma, VM_MAYWRITE);
+#else
+    vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+    return remap_vmalloc_range(vma, area, 0);
+}
+
+// streaming fds: a record is waiting; others: a second closed since the last read or reported poll
+
+static __poll_t kb_dev_poll(struct file *file, poll_table *wait)
+{
+    kb_file_t *f = file->private_data;
+    int avail = 0;
+
+    poll_wait(file, &kb_tick_wq, wait);
+
+    if (unlikely(READ_ONCE(kb_shutdown))) { return EPOLLHUP; }
+
+    if (!READ_ONCE(f->stream)) { kb_wake(ktime_get_ns(), 0); }
+
+    // reporting a second moves the fd past it, as a read does
+
+    mutex_lock(&f->lock);
+
+    avail = kb_tick_avail(f);
+    if (avail && !f->stream) { WRITE_ONCE(f->next_tick, READ_ONCE(kb_tick_cunt) + 1); }
+
+    mutex_unlock(&f->lock);
+
+    return avail ? (EPOLLIN | EPOLLRDNORM) : 0;
+}
+
+static long kb_query_check(const kb_query_t *q, size_t *cunt, size_t *rec_size, int *perkey)
+{
+    if (unlikely(q->window_mask == 0 || (q->window_mask & ~KB_WINDOW_MASK_ALL))) { return -EINVAL; }
+
+    if (unlikely(q->field_mask == 0 || (q->field_mask & ~KB_QUERY_FIELDS_ALL))) { return -EINVAL; }
 
-static int kb_connect(struct input_handler *handler, struct input_dev *dev, const struct input_device_id *id);
-static void kb_disconnect(struct input_handle *handle);
-static void kb_event(struct input_handle *handle, unsigned int type, unsigned int code, int val);
+    *perkey = (q->field_mask & KB_QUERY_PERKEY) != 0;
+    if (unlikely(*perkey && !kb_root_is())) { return -EPERM; }
 
-// bucket operations
+    *cunt = hweight32(q->window_mask);
+    *rec_size = *perkey ? sizeof(kb_window_stats_t) : sizeof(kb_window_stats_pub_t);
+    if (unlikely(q->buff_len < *cunt * *rec_size)) { return -EINVAL; }
 
-static void kb_bucket_zero(kb_bucket_t *b)
-{
-    memset(b, 0, sizeof(*b));
-    b->shortest_gap_ns = U64_MAX;
+    return 0;
 }
 
-static void kb_bucket_merge(kb_bucket_t *dst, const kb_bucket_t *src, int skip_perkey)
+static long kb_query_copy_out(const kb_query_t *q, const kb_window_stats_t *out, size_t cunt, size_t rec_size, int perkey)
 {
+    char __user *buff = u64_to_user_ptr(q->buff);
     size_t idx = 0;
-    uint64_t n_a = 0;
-    uint64_t n_b = 0;
-    uint64_t n_combined = 0;
-    int64_t delta = 0;
-    uint64_t mean_a = 0;
-    uint64_t mean_b = 0;
-
-    dst->press_cunt = KB_SAT_ADD32(dst->press_cunt, src->press_cunt);
-    dst->release_cunt = KB_SAT_ADD32(dst->release_cunt, src->release_cunt);
-    dst->char_cunt = KB_SAT_ADD32(dst->char_cunt, src->char_cunt);
-    dst->char_del_cunt = KB_SAT_ADD32(dst->char_del_cunt, src->char_del_cunt);
-    dst->word_del_cunt = KB_SAT_ADD32(dst->word_del_cunt, src->word_del_cunt);
 
-    n_a = dst->hold_cunt;
-    n_b = src->hold_cunt;
-    n_combined = n_a + n_b;
-    if (n_combined > 0)
+    for (idx = 0; idx < cunt; idx++)
     {
-        mean_a = (n_a > 0) ? (dst->hold_sum_ns / n_a) : 0;
-        mean_b = (n_b > 0) ? (src->hold_sum_ns / n_b) : 0;
-        delta = (int64_t)mean_b - (int64_t)mean_a;
-        dst->hold_m2 = KB_SAT_ADD64(dst->hold_m2, src->hold_m2);
-        dst->hold_m2 = KB_SAT_ADD64(dst->hold_m2, (uint64_t)(delta * delta) * n_a * n_b / n_combined);
+        if (perkey) { if (unlikely(copy_to_user(buff + idx * rec_size, &out[idx], rec_size))) { return -EFAULT; } }
+        else
+        {
+            kb_window_stats_pub_t pub;
+
+            kb_window_stats_pub_from(&pub, &out[idx]);
+            if (unlikely(copy_to_user(buff + idx * rec_size, &pub, rec_size))) { return -EFAULT; }
+        }
     }
 
-    dst->hold_sum_ns = KB_SAT_ADD64(dst->hold_sum_ns, src->hold_sum_ns);
-    dst->hold_cunt = KB_SAT_ADD32(dst->hold_cunt, src->hold_cunt);
+    return 0;
+}
 
-    if (src->longest_hold_ns > dst->longest_hold_ns) { dst->longest_hold_ns = src->longest_hold_ns; }
+static long kb_dev_query(void __user *uarg)
+{
+    kb_query_t q;
+    kb_window_stats_t *out = NULL;
+    kb_bucket_t *scratch = NULL;
+    size_t cunt = 0;
+    size_t rec_size = 0;
+    int perkey = 0;
+    long err = 0;
+
+    if (unlikely(copy_from_user(&q, uarg, sizeof(q)))) { return -EFAULT; }
+
+    err = kb_query_check(&q, &cunt, &rec_size, &perkey);
+    if (unlikely(err)) { return err; }
 
-    n_a = dst->gap_cunt;
-    n_b = src->gap_cunt;
-    n_combined = n_a + n_b;
-    if (n_combined > 0)
+    if (unlikely(READ_ONCE(kb_shutdown))) { return -ENODEV; }
+
+    out = kvmalloc_array(cunt, sizeof(kb_window_stats_t), GFP_KERNEL);
+    scratch = kvmalloc_array(2, sizeof(kb_bucket_t), GFP_KERNEL);
+    if (unlikely(!out || !scratch))
     {
-        mean_a = (n_a > 0) ? (dst->gap_sum_ns / n_a) : 0;
-        mean_b = (n_b > 0) ? (src->gap_sum_ns / n_b) : 0;
-        delta = (int64_t)mean_b - (int64_t)mean_a;
-        dst->gap_m2 = KB_SAT_ADD64(dst->gap_m2, src->gap_m2);
-        dst->gap_m2 = KB_SAT_ADD64(dst->gap_m2, (uint64_t)(delta * delta) * n_a * n_b / n_combined);
+        kvfree(out);
+        kvfree(scratch);
+        return -ENOMEM;
     }
 
-    dst->gap_sum_ns = KB_SAT_ADD64(dst->gap_sum_ns, src->gap_sum_ns);
-    dst->gap_cunt = KB_SAT_ADD32(dst->gap_cunt, src->gap_cunt);
+    kb_sync();
+    kb_snap_windows_fill(&kb_glob, NULL, out, NULL, q.window_mask, q.field_mask, scratch, &q.uptime_ns);
+    kvfree(scratch);
 
-    if (src->shortest_gap_ns < dst->shortest_gap_ns) { dst->shortest_gap_ns = src->shortest_gap_ns; }
+    err = kb_query_copy_out(&q, out, cunt, rec_size, perkey);
+    kvfree(out);
 
-    if (src->longest_gap_ns > dst->longest_gap_ns) { dst->longest_gap_ns = src->longest_gap_ns; }
+    if (!err && unlikely(copy_to_user(uarg, &q, sizeof(q)))) { err = -EFAULT; }
 
-    if (!skip_perkey) { for (idx = 0; idx < KB_KEY_MAX; idx++) { dst->per_key_cunt[idx] = KB_SAT_ADD32(dst->per_key_cunt[idx], src->per_key_cunt[idx]); } }
+    return err;
 }
 
-static void kb_window_from_ring(kb_window_stats_t *w, const kb_bucket_t *ring, size_t ring_size, size_t head, size_t cunt, size_t bucket_secs, const kb_bucket_t *live_bucket, kb_bucket_t *acc, int skip_perkey)
+// caller holds rcu_read_lock()
+
+static kb_kbd_t *kb_kbd_find(const kb_kbd_id_t *id)
 {
-    size_t idx = 0;
-    size_t start = 0;
-    uint32_t peak = 0;
-    uint64_t duration_secs = 0;
+    kb_kbd_t *k = NULL;
 
-    kb_bucket_zero(acc);
+    list_for_each_entry_rcu(k, &kb_kbds, node) { if (k->id.vendor == id->vendor && k->id.product == id->product && strncmp(k->id.phys, id->phys, KB_PHYS_LEN) == 0) { return k; } }
 
-    if (live_bucket) { kb_bucket_merge(acc, live_bucket, skip_perkey); }
+    return NULL;
+}
 
-    if (cunt > ring_size) { cunt = ring_size; }
+static long kb_dev_kbd_list(void __user *uarg)
+{
+    kb_kbd_list_t l;
+    kb_kbd_id_t *ids = NULL;
+    kb_kbd_t *k = NULL;
+    size_t cap = 0;
+    size_t cunt = 0;
+    long err = 0;
 
-    start = (head + ring_size - cunt) % ring_size;
+    if (unlikely(copy_from_user(&l, uarg, sizeof(l)))) { return -EFAULT; }
 
-    for (idx = 0; idx < cunt; idx++)
+    cap = min_t(uint64_t, l.buff_len / sizeof(kb_kbd_id_t), KB_KBD_LIST_MAX);
+
+    if (cap > 0)
+    {
+        ids = kvmalloc_array(cap, sizeof(kb_kbd_id_t), GFP_KERNEL);
+        if (unlikely(!ids)) { return -ENOMEM; }
+    }
+
+    rcu_read_lock();
+
+    list_for_each_entry_rcu(k, &kb_kbds, node)
     {
-        size_t pos = (start + idx) % ring_size;
-        kb_bucket_merge(acc, &ring[pos], skip_perkey);
+        if (cunt < cap) { ids[cunt] = k->id; }
 
-        if (ring[pos].press_cunt > peak) { peak = ring[pos].press_cunt; }
+        cunt++;
     }
 
-    w->keystroke_cunt = acc->press_cunt;
-    w->release_cunt = acc->release_cunt;
-    w->char_cunt = acc->char_cunt;
-    w->char_del_cunt = acc->char_del_cunt;
-    w->word_del_cunt = acc->word_del_cunt;
-    w->longest_hold_ns = acc->longest_hold_ns;
-    w->shortest_gap_ns = (acc->shortest_gap_ns == U64_MAX) ? 0 : acc->shortest_gap_ns;
-    w->longest_gap_ns = acc->longest_gap_ns;
-    w->avg_hold_ns = (acc->hold_cunt > 0) ? (acc->hold_sum_ns / acc->hold_cunt) : 0;
-    w->hold_var_ns = (acc->hold_cunt > 0) ? (acc->hold_m2 / acc->hold_cunt) : 0;
-    w->avg_gap_ns = (acc->gap_cunt > 0) ? (acc->gap_sum_ns / acc->gap_cunt) : 0;
-    w->gap_var_ns = (acc->gap_cunt > 0) ? (acc->gap_m2 / acc->gap_cunt) : 0;
+    rcu_read_unlock();
 
-    duration_secs = cunt * bucket_secs;
-    if (live_bucket) { duration_secs += 1; }
+    if (cap > 0 && unlikely(copy_to_user(u64_to_user_ptr(l.buff), ids, min(cunt, cap) * sizeof(kb_kbd_id_t)))) { err = -EFAULT; }
 
-    w->avg_kps = (duration_secs > 0) ? ((uint64_t)acc->press_cunt * 1000 / duration_secs) : 0;
-    w->avg_cps = (duration_secs > 0) ? ((uint64_t)acc->char_cunt * 1000 / duration_secs) : 0;
-    w->peak_kps = (uint64_t)peak * 1000;
+    kvfree(ids);
 
-    if (!skip_perkey) { for (idx = 0; idx < KB_KEY_MAX; idx++) { w->per_key_cunt[idx] = acc->per_key_cunt[idx]; } }
-}
+    l.cunt = (uint32_t)cunt;
+    if (!err && unlikely(copy_to_user(uarg, &l, sizeof(l)))) { err = -EFAULT; }
 
-// timer callback
+    return err;
+}
 
-static void kb_timer_cb(struct timer_list *t)
+static long kb_dev_kbd_query(void __user *uarg)
 {
-    unsigned long flags = 0;
+    kb_kbd_query_t q;
+    kb_kbd_t *k = NULL;
+    kb_window_stats_t *out = NULL;
+    kb_bucket_t *scratch = NULL;
+    size_t cunt = 0;
+    size_t rec_size = 0;
+    int perkey = 0;
+    long err = 0;
 
-    spin_lock_irqsave(&kb_lock, flags);
+    if (unlikely(copy_from_user(&q, uarg, sizeof(q)))) { return -EFAULT; }
 
-    if (READ_ONCE(kb_shutdown))
+    q.id.phys[KB_PHYS_LEN - 1] = '\0';
+
+    err = kb_query_check(&q.query, &cunt, &rec_size, &perkey);
+    if (unlikely(err)) { return err; }
+
+    if (unlikely(READ_ONCE(kb_shutdown))) { return -ENODEV; }
+
+    out = kvmalloc_array(cunt, sizeof(kb_window_stats_t), GFP_KERNEL);
+    scratch = kvmalloc_array(2, sizeof(kb_bucket_t), GFP_KERNEL);
+    if (unlikely(!out || !scratch))
     {
-        spin_unlock_irqrestore(&kb_lock, flags);
-        return;
+        kvfree(out);
+        kvfree(scratch);
+        return -ENOMEM;
     }
 
-    kb_secs_ring[kb_secs_idx] = kb_live;
-    kb_secs_idx = (kb_secs_idx + 1) % KB_SECS_RING_SIZE;
-    kb_bucket_zero(&kb_live);
+    kb_sync();
 
-    kb_tick_cunt++;
+    // the device stays allocated until a grace period after it leaves kb_kbds
 
-    if (kb_tick_cunt % 60 == 0)
-    {
-        size_t idx = 0;
+    rcu_read_lock();
 
-        kb_bucket_zero(kb_scratch_timer);
-        for (idx = 0; idx < KB_SECS_RING_SIZE; idx++) { kb_bucket_merge(kb_scratch_timer, &kb_secs_ring[idx], 0); }
-        kb_mins_ring[kb_mins_idx] = *kb_scratch_timer;
-        kb_mins_idx = (kb_mins_idx + 1) % KB_MINS_RING_SIZE;
-    }
+    k = kb_kbd_find(&q.id);
+    if (!k) { err = -ENODEV; }
+    else if (!k->tiers.arena) { err = -ENODATA; }
+    else { kb_snap_windows_fill(&k->tiers, k, out, NULL, q.query.window_mask, q.query.field_mask, scratch, &q.query.uptime_ns); }
 
-    if (kb_tick_cunt % 3600 == 0)
-    {
-        size_t idx = 0;
+    rcu_read_unlock();
 
-        kb_bucket_zero(kb_scratch_timer);
-        for (idx = 0; idx < KB_MINS_RING_SIZE; idx++) { kb_bucket_merge(kb_scratch_timer, &kb_mins_ring[idx], 0); }
-        kb_hours_ring[kb_hours_idx] = *kb_scratch_timer;
-        kb_hours_idx = (kb_hours_idx + 1) % KB_HOURS_RING_SIZE;
-    }
+    kvfree(scratch);
 
-    if (kb_tick_cunt % 86400 == 0)
-    {
-        size_t idx = 0;
+    if (!err) { err = kb_query_copy_out(&q.query, out, cunt, rec_size, perkey); }
 
-        kb_bucket_zero(kb_scratch_timer);
-        for (idx = 0; idx < KB_HOURS_RING_SIZE; idx++) { kb_bucket_merge(kb_scratch_timer, &kb_hours_ring[idx], 0); }
-        kb_days_ring[kb_days_idx] = *kb_scratch_timer;
-        kb_days_idx = (kb_days_idx + 1) % KB_DAYS_RING_SIZE;
-    }
+    kvfree(out);
 
-    if (!READ_ONCE(kb_shutdown)) { mod_timer(&kb_timer, jiffies + HZ); }
+    if (!err && unlikely(copy_to_user(uarg, &q, sizeof(q)))) { err = -EFAULT; }
 
-    spin_unlock_irqrestore(&kb_lock, flags);
+    return err;
 }
 
-// character device
+// range query over kb_glob; the worker rolls tiers under kb_kbd_mutex, so holding it is enough
 
-static int kb_dev_open(struct inode *inode, struct file *file)
+static long kb_dev_range(void __user *uarg)
 {
-    return 0;
-}
+    kb_range_query_t q;
+    kb_window_agg_t *agg = NULL;
+    kb_window_stats_t *w = NULL;
+    kb_bucket_t *acc = NULL;
+    size_t size = 0;
+    uint64_t uptime_ns = 0;
+    long err = 0;
 
-static ssize_t kb_dev_rd(struct file *file, char __user *buff, size_t len, loff_t *off)
-{
-    kb_stats_t *stats = NULL;
-    unsigned long flags = 0;
-    int is_root = uid_eq(current_uid(), GLOBAL_ROOT_UID) || uid_eq(current_euid(), GLOBAL_ROOT_UID);
-    size_t out_size = is_root ? sizeof(kb_stats_t) : sizeof(kb_stats_pub_t);
+    if (unlikely(copy_from_user(&q, uarg, sizeof(q)))) { return -EFAULT; }
 
-    if (unlikely(*off > 0)) { return 0; }
+    if (unlikely(q.tier >= KB_TIER_CUNT)) { return -EINVAL; }
 
-    if (unlikely(len < out_size)) { return -EINVAL; }
+    size = kb_glob.rings[q.tier].size;
+    if (unlikely(q.len == 0 || (uint64_t)q.off + q.len > size)) { return -EINVAL; }
 
-    stats = kvmalloc(sizeof(kb_stats_t), GFP_KERNEL);
-    if (unlikely(!stats)) { return -ENOMEM; }
+    if (unlikely(READ_ONCE(kb_shutdown))) { return -ENODEV; }
 
-    memset(stats, 0, sizeof(*stats));
+    agg = kvmalloc(sizeof(kb_window_agg_t), GFP_KERNEL);
+    w = kvmalloc(sizeof(kb_window_stats_t), GFP_KERNEL);
+    acc = kvmalloc(sizeof(kb_bucket_t), GFP_KERNEL);
+    if (unlikely(!agg || !w || !acc))
+    {
+        kvfree(agg);
+        kvfree(w);
+        kvfree(acc);
+        return -ENOMEM;
+    }
 
-    spin_lock_irqsave(&kb_lock, flags);
+    kb_sync();
 
-    if (unlikely(READ_ONCE(kb_shutdown)))
+    err = mutex_lock_interruptible(&kb_kbd_mutex);
+    if (unlikely(err))
     {
-        spin_unlock_irqrestore(&kb_lock, flags);
-        kvfree(stats);
-        return -ENODEV;
+        kvfree(agg);
+        kvfree(w);
+        kvfree(acc);
+        return err;
     }
 
-    stats->uptime_ns = ktime_get_ns() - kb_init_ns;
-    stats->last_vendor = kb_last_vendor;
-    stats->last_product = kb_last_product;
+    kb_range_fold(&agg->acc, &kb_glob.ranges[q.tier], size, kb_glob.rings[q.tier].idx, q.off, q.len);
+    uptime_ns = ktime_get_ns() - kb_glob.born_ns;
 
-    kb_window_from_ring(&stats->windows[0], kb_secs_ring, KB_SECS_RING_SIZE, kb_secs_idx, KB_SECS_RING_SIZE, 1, &kb_live, kb_scratch_rd, !is_root);
+    mutex_unlock(&kb_kbd_mutex);
 
-    kb_window_from_ring(&stats->windows[1], kb_mins_ring, KB_MINS_RING_SIZE, kb_mins_idx, 5, 60, &kb_live, kb_scratch_rd, !is_root);
+    agg->span = q.len;
+    agg->bucket_secs = kb_tier_descs[q.tier].secs;
 
-    kb_window_from_ring(&stats->windows[2], kb_mins_ring, KB_MINS_RING_SIZE, kb_mins_idx, 30, 60, &kb_live, kb_scratch_rd, !is_root);
+    kb_window_stats_fill(w, agg, NULL, 0, KB_SAT_SUB(uptime_ns, (uint64_t)q.off * kb_tier_descs[q.tier].secs * NSEC_PER_SEC), acc, KB_QUERY_SCALAR);
+    kb_window_stats_pub_from(&q.stats, w);
+    q.uptime_ns = uptime_ns;
 
-    kb_window_from_ring(&stats->windows[3], kb_hours_ring, KB_HOURS_RING_SIZE, kb_hours_idx, 6, 3600, &kb_live, kb_scratch_rd, !is_root);
+    kvfree(agg);
+    kvfree(w);
+    kvfree(acc);
 
-    kb_window_from_ring(&stats->windows[4], kb_hours_ring, KB_HOURS_RING_SIZE, kb_hours_idx, KB_HOURS_RING_SIZE, 3600, &kb_live, kb_scratch_rd, !is_root);
+    if (unlikely(copy_to_user(uarg, &q, sizeof(q)))) { return -EFAULT; }
 
-    kb_window_from_ring(&stats->windows[5], kb_days_ring, KB_DAYS_RING_SIZE, kb_days_idx, 7, 86400, &kb_live, kb_scratch_rd, !is_root);
+    return 0;
+}
 
-    kb_window_from_ring(&stats->windows[6], kb_days_ring, KB_DAYS_RING_SIZE, kb_days_idx, 30, 86400, &kb_live, kb_scratch_rd, !is_root);
+static long kb_dev_ioctl(struct file *file, unsigned int cmd, unsigned long arg)
+{
+    kb_file_t *f = file->private_data;
+    uint32_t enable = 0;
+    long err = 0;
 
-    kb_window_from_ring(&stats->windows[7], kb_days_ring, KB_DAYS_RING_SIZE, kb_days_idx, KB_DAYS_RING_SIZE, 86400, &kb_live, kb_scratch_rd, !is_root);
+    switch (cmd)
+    {
+        case KB_IOC_STREAM:
+            if (unlikely(copy_from_user(&enable, (const void __user *)arg, sizeof(enable)))) { return -EFAULT; }
 
-    spin_unlock_irqrestore(&kb_lock, flags);
+            // test and flip under the fd's lock, or two threads enabling one fd would both count it
 
-    if (is_root)
-    {
-        if (unlikely(copy_to_user(buff, stats, sizeof(kb_stats_t))))
-        {
-            kvfree(stats);
-            return -EFAULT;
-        }
+            err = mutex_lock_interruptible(&f->lock);
+            if (unlikely(err)) { return err; }
 
-        *off += sizeof(kb_stats_t);
-        kvfree(stats);
-        return sizeof(kb_stats_t);
-    }
-    else
-    {
-        kb_stats_pub_t pub;
-        size_t i = 0;
+            if (enable && !f->stream)
+            {
+                atomic_inc(&kb_stream_cunt);
+                kb_wake(ktime_get_ns(), 1);
+            }
 
-        memset(&pub, 0, sizeof(pub));
-        pub.uptime_ns = stats->uptime_ns;
-        pub.last_vendor = stats->last_vendor;
-        pub.last_product = stats->last_product;
+            if (!enable && f->stream) { atomic_dec(&kb_stream_cunt); }
 
-        for (i = 0; i < KB_WINDOW_CUNT; i++)
-        {
-            pub.windows[i].keystroke_cunt = stats->windows[i].keystroke_cunt;
-            pub.windows[i].release_cunt = stats->windows[i].release_cunt;
-            pub.windows[i].char_cunt = stats->windows[i].char_cunt;
-            pub.windows[i].char_del_cunt = stats->windows[i].char_del_cunt;
-            pub.windows[i].word_del_cunt = stats->windows[i].word_del_cunt;
-            pub.windows[i].avg_kps = stats->windows[i].avg_kps;
-            pub.windows[i].avg_cps = stats->windows[i].avg_cps;
-            pub.windows[i].peak_kps = stats->windows[i].peak_kps;
-            pub.windows[i].avg_hold_ns = stats->windows[i].avg_hold_ns;
-            pub.windows[i].hold_var_ns = stats->windows[i].hold_var_ns;
-            pub.windows[i].longest_hold_ns = stats->windows[i].longest_hold_ns;
-            pub.windows[i].avg_gap_ns = stats->windows[i].avg_gap_ns;
-            pub.windows[i].gap_var_ns = stats->windows[i].gap_var_ns;
-            pub.windows[i].shortest_gap_ns = stats->windows[i].shortest_gap_ns;
-            pub.windows[i].longest_gap_ns = stats->windows[i].longest_gap_ns;
-        }
+            WRITE_ONCE(f->stream, (enable != 0));
+            WRITE_ONCE(f->next_tick, READ_ONCE(kb_tick_cunt) + 1);
+
+            mutex_unlock(&f->lock);
+            return 0;
+
+        case KB_IOC_QUERY:
+            return kb_dev_query((void __user *)arg);
+
+        case KB_IOC_KBD_LIST:
+            return kb_dev_kbd_list((void __user *)arg);
 
-        kvfree(stats);
+        case KB_IOC_KBD_QUERY:
+            return kb_dev_kbd_query((void __user *)arg);
 
-        if (unlikely(copy_to_user(buff, &pub, sizeof(kb_stats_pub_t)))) { return -EFAULT; }
+        case KB_IOC_RANGE:
+            return kb_dev_range((void __user *)arg);
 
-        *off += sizeof(kb_stats_pub_t);
-        return sizeof(kb_stats_pub_t);
+        default:
+            return -ENOTTY;
     }
 }
 
 static int kb_dev_release(struct inode *inode, struct file *file)
 {
+    kb_file_t *f = file->private_data;
+
+    if (f->stream) { atomic_dec(&kb_stream_cunt); }
+
+    kvfree(f->scratch);
+    kfree(f);
     return 0;
 }
 
 static const struct file_operations kb_fops =
 {
-    .owner = THIS_MODULE, .open = kb_dev_open, .release = kb_dev_release, .read = kb_dev_rd, .llseek = default_llseek, };
+    .owner = THIS_MODULE, .open = kb_dev_open, .release = kb_dev_release, .read = kb_dev_rd, .poll = kb_dev_poll, .unlocked_ioctl = kb_dev_ioctl, .compat_ioctl = compat_ptr_ioctl, .mmap = kb_dev_mmap, .llseek = default_llseek, };
 
 static struct miscdevice kb_misc_dev =
 {
@@ -468,128 +2179,264 @@ static const struct input_device_id kb_ids[] =
 };
 MODULE_DEVICE_TABLE(input, kb_ids);
 
+// since 6.11 the input core accepts only one of filter/events/event, and wraps .event in its own .events anyway
+
 static struct input_handler kb_handler =
 {
-    .event = kb_event, .connect = kb_connect, .disconnect = kb_disconnect, .name = "kaybeestat", .id_table = kb_ids
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+    .events = kb_events, .connect = kb_connect, .disconnect = kb_disconnect, .name = "kaybeestat", .id_table = kb_ids
+#else
+    .events = kb_events, .event = kb_event, .connect = kb_connect, .disconnect = kb_disconnect, .name = "kaybeestat", .id_table = kb_ids
+#endif
 };
 
-static void kb_event(struct input_handle *handle, unsigned int type, unsigned int code, int val)
+// keyboards have the digit row and the three letter rows; other EV_KEY devices stop here
+
+static const uint16_t kb_alnum_ranges[][2] = {
+    { KEY_1, KEY_0 }, { KEY_Q, KEY_P }, { KEY_A, KEY_L }, { KEY_Z, KEY_M },
+};
+
+static int kb_vp_listed_is(const kb_vp_t *ids, size_t cunt, const struct input_dev *dev)
 {
-    uint64_t now = 0;
-    uint64_t hold_ns = 0;
-    uint64_t gap_ns = 0;
-    unsigned long flags = 0;
+    size_t idx = 0;
 
-    if (unlikely(type != EV_KEY || val == 2)) { return; }
+    for (idx = 0; idx < cunt; idx++) { if (ids[idx].vendor == dev->id.vendor && ids[idx].product == dev->id.product) { return 1; } }
 
-    if (unlikely(code >= KB_KEY_MAX)) { return; }
+    return 0;
+}
+
+static int kb_kbd_is(const struct input_dev *dev)
+{
+    size_t idx = 0;
+    unsigned int code = 0;
 
-    now = ktime_get_ns();
+    if (!test_bit(EV_KEY, dev->evbit)) { return 0; }
 
-    spin_lock_irqsave(&kb_lock, flags);
+    if (kb_vp_listed_is(kb_deny_ids, kb_deny_cunt, dev)) { return 0; }
+
+    if (kb_vp_listed_is(kb_allow_ids, kb_allow_cunt, dev)) { return 1; }
+
+    for (idx = 0; idx < ARRAY_SIZE(kb_alnum_ranges); idx++) { for (code = kb_alnum_ranges[idx][0]; code <= kb_alnum_ranges[idx][1]; code++) { if (!test_bit(code, dev->keybit)) { return 0; } } }
+
+    return 1;
+}
+
+static inline int kb_key_value_is(const struct input_value *v)
+{
+    return v->type == EV_KEY && v->value != 2 && v->code < KB_KEY_MAX;
+}
+
+// presses in the 1 s ending at now, in KB_RATE_SLOT_CUNT slots cleared as the head passes them
+
+static uint32_t kb_rate_note(kb_kbd_t *k, uint64_t now)
+{
+    uint64_t slot = div_u64(now, KB_RATE_SLOT_NS);
+    uint64_t step = 0;
 
-    if (code == KEY_LEFTCTRL || code == KEY_RIGHTCTRL) { kb_ctrl_held = (val == 1); }
+    if (slot > k->rate_head)
+    {
+        for (step = min_t(uint64_t, slot - k->rate_head, KB_RATE_SLOT_CUNT); step > 0; step--)
+        {
+            k->rate_idx = (k->rate_idx + 1) % KB_RATE_SLOT_CUNT;
+            k->rate_cunt -= k->rate_slots[k->rate_idx];
+            k->rate_slots[k->rate_idx] = 0;
+        }
+
+        k->rate_head = slot;
+    }
+
+    if (k->rate_slots[k->rate_idx] < U16_MAX)
+    {
+        k->rate_slots[k->rate_idx]++;
+        k->rate_cunt++;
+    }
 
-    if (code == KEY_LEFTALT || code == KEY_RIGHTALT) { kb_alt_held = (val == 1); }
+    return k->rate_cunt;
+}
+
+// accounts one key press or release into k's live bucket; caller holds k->lock
+
+static void kb_key_account(kb_kbd_t *k, unsigned int code, int val, uint64_t now)
+{
+    kb_bucket_t *b = &k->live;
+    unsigned long cls = (code < KB_KEY_CLASS_TABLE_SIZE) ? kb_key_class[code] : 0;
+    unsigned int bit = 0;
+    uint32_t rate_cunt = 0;
+    uint64_t hold_ns = 0;
+    uint64_t gap_ns = 0;
+    uint64_t prev_ns = 0;
 
-    kb_last_vendor = handle->dev->id.vendor;
-    kb_last_product = handle->dev->id.product;
+    if (code == KEY_LEFTCTRL || code == KEY_RIGHTCTRL) { k->ctrl_held = (val == 1); }
+
+    if (code == KEY_LEFTALT || code == KEY_RIGHTALT) { k->alt_held = (val == 1); }
 
     if (val == 1)
     {
-        kb_live.press_cunt++;
-        kb_live.per_key_cunt[code]++;
-        if (kb_key_printable_is(code)) { kb_live.char_cunt++; }
+        b->press_cunt++;
+        b->key_cunt[kb_key_slot[code]]++;
+
+        rate_cunt = kb_rate_note(k, now);
+        if (rate_cunt > b->peak_press_cunt) { b->peak_press_cunt = rate_cunt; }
 
-        kb_key_press_ts[code] = now;
+        for_each_set_bit(bit, &cls, KB_KEY_CLASS_CUNT) { b->class_cunt[bit]++; }
 
-        if (code == KEY_BACKSPACE) { if (kb_alt_held) { kb_live.word_del_cunt++; }
-            else { kb_live.char_del_cunt++; } }
-        else if (code == KEY_W && kb_ctrl_held) { kb_live.word_del_cunt++; }
+        k->key_press_ts[code] = now;
 
-        if (kb_last_press_ns > 0 && now >= kb_last_press_ns)
+        if (code == KEY_BACKSPACE) { if (k->alt_held) { b->word_del_cunt++; }
+            else { b->char_del_cunt++; } }
+        else if (code == KEY_W && k->ctrl_held) { b->word_del_cunt++; }
+
+        prev_ns = k->last_press_ns;
+        k->last_press_ns = now;
+
+        if (prev_ns > 0 && now >= prev_ns)
         {
-            gap_ns = now - kb_last_press_ns;
+            gap_ns = now - prev_ns;
 
             if (gap_ns >= KB_MIN_GAP_NS)
             {
-                uint64_t old_mean = 0;
-                uint64_t new_mean = 0;
-                int64_t delta = 0;
-                int64_t delta2 = 0;
-
-                old_mean = (kb_live.gap_cunt > 0) ? (kb_live.gap_sum_ns / kb_live.gap_cunt) : 0;
-                kb_live.gap_sum_ns = KB_SAT_ADD64(kb_live.gap_sum_ns, gap_ns);
-                kb_live.gap_cunt++;
-                new_mean = kb_live.gap_sum_ns / kb_live.gap_cunt;
-                delta = (int64_t)gap_ns - (int64_t)old_mean;
-                delta2 = (int64_t)gap_ns - (int64_t)new_mean;
-                kb_live.gap_m2 = KB_SAT_ADD64(kb_live.gap_m2, (uint64_t)(delta * delta2));
-
-                if (gap_ns < kb_live.shortest_gap_ns) { kb_live.shortest_gap_ns = gap_ns; }
-
-                if (gap_ns > kb_live.longest_gap_ns) { kb_live.longest_gap_ns = gap_ns; }
+                b->gap_sum_ns = KB_SAT_ADD64(b->gap_sum_ns, gap_ns);
+                b->gap_cunt++;
+                kb_u128_add(&b->gap_sumsq, kb_u128_mul(gap_ns, gap_ns));
+                b->gap_hist[kb_hist_bin(gap_ns)]++;
+
+                if (gap_ns < b->shortest_gap_ns) { b->shortest_gap_ns = gap_ns; }
+
+                if (gap_ns > b->longest_gap_ns) { b->longest_gap_ns = gap_ns; }
             }
         }
-
-        kb_last_press_ns = now;
     }
     else
     {
-        kb_live.release_cunt++;
-
-        if (kb_key_press_ts[code] > 0)
-        {
-            uint64_t old_mean = 0;
-            uint64_t new_mean = 0;
-            int64_t delta = 0;
-            int64_t delta2 = 0;
+        uint64_t press_ns = k->key_press_ts[code];
 
-            hold_ns = now - kb_key_press_ts[code];
+        k->key_press_ts[code] = 0;
+        b->release_cunt++;
 
-            old_mean = (kb_live.hold_cunt > 0) ? (kb_live.hold_sum_ns / kb_live.hold_cunt) : 0;
-            kb_live.hold_sum_ns = KB_SAT_ADD64(kb_live.hold_sum_ns, hold_ns);
-            kb_live.hold_cunt++;
-            new_mean = kb_live.hold_sum_ns / kb_live.hold_cunt;
-            delta = (int64_t)hold_ns - (int64_t)old_mean;
-            delta2 = (int64_t)hold_ns - (int64_t)new_mean;
-            kb_live.hold_m2 = KB_SAT_ADD64(kb_live.hold_m2, (uint64_t)(delta * delta2));
+        if (press_ns > 0 && now >= press_ns)
+        {
+            hold_ns = now - press_ns;
 
-            if (hold_ns > kb_live.longest_hold_ns) { kb_live.longest_hold_ns = hold_ns; }
+            b->hold_sum_ns = KB_SAT_ADD64(b->hold_sum_ns, hold_ns);
+            b->hold_cunt++;
+            kb_u128_add(&b->hold_sumsq, kb_u128_mul(hold_ns, hold_ns));
+            b->hold_hist[kb_hist_bin(hold_ns)]++;
 
-            kb_key_press_ts[code] = 0;
+            if (hold_ns > b->longest_hold_ns) { b->longest_hold_ns = hold_ns; }
         }
     }
+}
 
-    spin_unlock_irqrestore(&kb_lock, flags);
+// one frame is accounted under one lock with one timestamp; input_get_timestamp() stamps it lazily
+// for the first handler that asks, so the clock read is only saved if the driver or evdev already did
+
+static void kb_frame_account(struct input_handle *handle, const struct input_value *vals, unsigned int cunt)
+{
+    kb_kbd_t *k = container_of(handle, kb_kbd_t, handle);
+    uint32_t id = ((uint32_t)k->id.vendor << 16) | k->id.product;
+    uint64_t now = 0;
+    unsigned int idx = 0;
+    int idle = 0;
+
+    for (idx = 0; idx < cunt; idx++) { if (kb_key_value_is(&vals[idx])) { break; } }
+
+    if (idx == cunt) { return; }
+
+    now = kb_ts_input ? (uint64_t)ktime_to_ns(input_get_timestamp(handle->dev)[INPUT_CLK_MONO]) : ktime_get_ns();
+
+    if (READ_ONCE(kb_last_id) != id) { WRITE_ONCE(kb_last_id, id); }
+
+    if (unlikely(READ_ONCE(kb_idle))) { kb_wake(now, 1); }
+
+    // the input core delivers events under dev->event_lock with irqs off
+
+    spin_lock(&k->lock);
+
+    for (; idx < cunt; idx++) { if (kb_key_value_is(&vals[idx])) { kb_key_account(k, vals[idx].code, vals[idx].value, now); } }
+
+    // the timer may have gone idle since the check above without seeing this frame
+
+    idle = READ_ONCE(kb_idle);
+
+    spin_unlock(&k->lock);
+
+    if (unlikely(idle)) { kb_wake(now, 1); }
+}
+
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 11, 0)
+static unsigned int kb_events(struct input_handle *handle, struct input_value *vals, unsigned int cunt)
+{
+    kb_frame_account(handle, vals, cunt);
+    return cunt;
+}
+#else
+static void kb_events(struct input_handle *handle, const struct input_value *vals, unsigned int cunt)
+{
+    kb_frame_account(handle, vals, cunt);
+}
+
+static void kb_event(struct input_handle *handle, unsigned int type, unsigned int code, int val)
+{
+    struct input_value v = { .type = (uint16_t)type, .code = (uint16_t)code, .value = val };
+
+    kb_frame_account(handle, &v, 1);
 }
+#endif
 
 static int kb_connect(struct input_handler *handler, struct input_dev *dev, const struct input_device_id *id)
 {
-    struct input_handle *handle = NULL;
+    kb_kbd_t *k = NULL;
+    unsigned long flags = 0;
     int err = 0;
 
-    if (!test_bit(EV_KEY, dev->evbit)) { return -ENODEV; }
+    if (!kb_kbd_is(dev))
+    {
+        printk(KERN_DEBUG "KayBeeStat: skipping non-keyboard dev: %s\n", dev->name);
+        return -ENODEV;
+    }
+
+    k = kzalloc(sizeof(kb_kbd_t), GFP_KERNEL);
+    if (unlikely(!k)) { return -ENOMEM; }
 
-    handle = kzalloc(sizeof(struct input_handle), GFP_KERNEL);
-    if (unlikely(!handle)) { return -ENOMEM; }
+    if (unlikely(kb_tiers_alloc(&k->tiers, ktime_get_ns(), 0))) { printk(KERN_ERR "KayBeeStat: no room for dev %s's own tiers under max_kb=%u; counting it in the all-device stats only\n", dev->name, kb_max_kb); }
 
-    handle->dev = dev;
-    handle->handler = handler;
-    handle->name = "kaybeestat";
+    spin_lock_init(&k->lock);
+    kb_bucket_zero(&k->live);
+    k->id.vendor = dev->id.vendor;
+    k->id.product = dev->id.product;
+    strscpy(k->id.phys, dev->phys ? dev->phys : "", KB_PHYS_LEN);
 
-    err = input_register_handle(handle);
+    k->handle.dev = dev;
+    k->handle.handler = handler;
+    k->handle.name = "kaybeestat";
+
+    err = input_register_handle(&k->handle);
     if (unlikely(err))
     {
-        kfree(handle);
+        kb_tiers_free(&k->tiers);
+        kfree(k);
         return err;
     }
 
-    err = input_open_device(handle);
+    mutex_lock(&kb_kbd_mutex);
+    spin_lock_irqsave(&kb_lock, flags);
+    list_add_tail_rcu(&k->node, &kb_kbds);
+    spin_unlock_irqrestore(&kb_lock, flags);
+    mutex_unlock(&kb_kbd_mutex);
+
+    err = input_open_device(&k->handle);
     if (unlikely(err))
     {
-        input_unregister_handle(handle);
-        kfree(handle);
+        mutex_lock(&kb_kbd_mutex);
+        spin_lock_irqsave(&kb_lock, flags);
+        list_del_rcu(&k->node);
+        spin_unlock_irqrestore(&kb_lock, flags);
+        mutex_unlock(&kb_kbd_mutex);
+
+        synchronize_rcu();
+        input_unregister_handle(&k->handle);
+        kb_tiers_free(&k->tiers);
+        kfree(k);
         return err;
     }
 
@@ -599,11 +2446,75 @@ static int kb_connect(struct input_handler *handler, struct input_dev *dev, cons
 
 static void kb_disconnect(struct input_handle *handle)
 {
+    kb_kbd_t *k = container_of(handle, kb_kbd_t, handle);
+    unsigned long flags = 0;
+
     printk(KERN_INFO "KayBeeStat: dc from dev: %s\n", handle->dev->name);
 
     input_close_device(handle);
+
+    mutex_lock(&kb_kbd_mutex);
+    spin_lock_irqsave(&kb_lock, flags);
+    write_seqcount_begin(&kb_snap_seq);
+
+    spin_lock(&k->lock);
+    kb_bucket_merge(&kb_glob.closed[kb_closed_cur], &k->live, 0);
+    kb_bucket_zero(&k->live);
+    spin_unlock(&k->lock);
+
+    list_del_rcu(&k->node);
+
+    write_seqcount_end(&kb_snap_seq);
+    spin_unlock_irqrestore(&kb_lock, flags);
+    mutex_unlock(&kb_kbd_mutex);
+
+    synchronize_rcu();
+
     input_unregister_handle(handle);
-    kfree(handle);
+    kb_tiers_free(&k->tiers);
+    kfree(k);
+}
+
+// parses "vvvv:pppp,vvvv:pppp" (hex) into ids
+
+static int __init kb_vp_list_parse(const char *s, kb_vp_t *ids, size_t *cunt)
+{
+    char *buff = NULL;
+    char *cur = NULL;
+    char *tok = NULL;
+    char *sep = NULL;
+    int err = 0;
+
+    *cunt = 0;
+
+    if (!s || *s == '\0') { return 0; }
+
+    buff = kstrdup(s, GFP_KERNEL);
+    if (unlikely(!buff)) { return -ENOMEM; }
+
+    cur = buff;
+
+    while (!err && (tok = strsep(&cur, ",")) != NULL)
+    {
+        tok = strim(tok);
+        if (*tok == '\0') { continue; }
+
+        sep = strchr(tok, ':');
+        if (unlikely(!sep || *cunt >= KB_VP_LIST_MAX))
+        {
+            err = -EINVAL;
+            break;
+        }
+
+        *sep = '\0';
+        err = kstrtou16(tok, 16, &ids[*cunt].vendor);
+        if (!err) { err = kstrtou16(sep + 1, 16, &ids[*cunt].product); }
+
+        if (!err) { (*cunt)++; }
+    }
+
+    kfree(buff);
+    return err;
 }
 
 // module init
@@ -612,48 +2523,101 @@ static int __init kb_init(void)
 {
     int err = 0;
     size_t idx = 0;
+    size_t arena_kb = 0;
+    uint32_t rem_ns = 0;
 
     printk(KERN_INFO "KayBeeStat: loading...\n");
 
-    kb_secs_ring = kvmalloc_array(KB_SECS_RING_SIZE, sizeof(kb_bucket_t), GFP_KERNEL | __GFP_ZERO);
-    kb_mins_ring = kvmalloc_array(KB_MINS_RING_SIZE, sizeof(kb_bucket_t), GFP_KERNEL | __GFP_ZERO);
-    kb_hours_ring = kvmalloc_array(KB_HOURS_RING_SIZE, sizeof(kb_bucket_t), GFP_KERNEL | __GFP_ZERO);
-    kb_days_ring = kvmalloc_array(KB_DAYS_RING_SIZE, sizeof(kb_bucket_t), GFP_KERNEL | __GFP_ZERO);
-    kb_scratch_timer = kvmalloc(sizeof(kb_bucket_t), GFP_KERNEL);
-    kb_scratch_rd = kvmalloc(sizeof(kb_bucket_t), GFP_KERNEL);
+    if (sysfs_streq(kb_clock, "input")) { kb_ts_input = 1; }
+    else if (sysfs_streq(kb_clock, "ktime")) { kb_ts_input = 0; }
+    else
+    {
+        printk(KERN_ERR "KayBeeStat: unknown clock '%s'; expected input or ktime\n", kb_clock);
+        return -EINVAL;
+    }
+
+    err = kb_vp_list_parse(kb_allow, kb_allow_ids, &kb_allow_cunt);
+    if (unlikely(err))
+    {
+        printk(KERN_ERR "KayBeeStat: bad allow list '%s'; expected up to %d vendor:product pairs\n", kb_allow, KB_VP_LIST_MAX);
+        return err;
+    }
+
+    err = kb_vp_list_parse(kb_deny, kb_deny_ids, &kb_deny_cunt);
+    if (unlikely(err))
+    {
+        printk(KERN_ERR "KayBeeStat: bad deny list '%s'; expected up to %d vendor:product pairs\n", kb_deny, KB_VP_LIST_MAX);
+        return err;
+    }
+
+    for (idx = 0; idx < KB_TIER_CUNT; idx++)
+    {
+        if (unlikely(*kb_tier_descs[idx].kept == 0 || *kb_tier_descs[idx].kept > kb_tier_descs[idx].kept_max))
+        {
+            printk(KERN_ERR "KayBeeStat: %s=%u out of range; expected 1-%u\n", kb_tier_descs[idx].param, *kb_tier_descs[idx].kept, kb_tier_descs[idx].kept_max);
+            return -EINVAL;
+        }
+    }
+
+    if (unlikely(kb_perkey_tiers & ~KB_TIER_MASK_ALL))
+    {
+        printk(KERN_ERR "KayBeeStat: bad perkey 0x%x; expected a tier mask within 0x%x\n", kb_perkey_tiers, KB_TIER_MASK_ALL);
+        return -EINVAL;
+    }
+
+    // kb_glob is charged first, so it alone must fit
 
-    if (unlikely(!kb_secs_ring || !kb_mins_ring || !kb_hours_ring || !kb_days_ring || !kb_scratch_timer || !kb_scratch_rd))
+    arena_kb = DIV_ROUND_UP(kb_tiers_carve(&kb_glob, NULL, 1), 1024);
+    if (unlikely(arena_kb > kb_max_kb))
+    {
+        printk(KERN_ERR "KayBeeStat: tier arena needs %zu KiB, over max_kb=%u; lower retention or clear perkey tiers\n", arena_kb, kb_max_kb);
+        return -EINVAL;
+    }
+
+    kb_wq = alloc_ordered_workqueue("kaybeestat", 0);
+    if (unlikely(!kb_wq))
+    {
+        printk(KERN_ERR "KayBeeStat: failed to alloc workqueue\n");
+        return -ENOMEM;
+    }
+
+    INIT_WORK(&kb_work, kb_work_fn);
+
+    kb_init_ns = ktime_get_ns();
+    div_u64_rem(kb_init_ns, NSEC_PER_SEC, &rem_ns);
+    kb_tick_base_ns = kb_init_ns - rem_ns;
+
+    err = kb_tiers_alloc(&kb_glob, kb_init_ns, 1);
+    kb_map_pub = vmalloc_user(PAGE_ALIGN(sizeof(kb_map_pub_t)));
+    kb_map_full = vmalloc_user(PAGE_ALIGN(sizeof(kb_map_t)));
+
+    if (unlikely(err || !kb_map_pub || !kb_map_full))
     {
         printk(KERN_ERR "KayBeeStat: failed to alloc ring buffers\n");
-        kvfree(kb_secs_ring);
-        kvfree(kb_mins_ring);
-        kvfree(kb_hours_ring);
-        kvfree(kb_days_ring);
-        kvfree(kb_scratch_timer);
-        kvfree(kb_scratch_rd);
+        kb_tiers_free(&kb_glob);
+        vfree(kb_map_pub);
+        vfree(kb_map_full);
+        destroy_workqueue(kb_wq);
         return -ENOMEM;
     }
 
-    for (idx = 0; idx < KB_SECS_RING_SIZE; idx++) { kb_secs_ring[idx].shortest_gap_ns = U64_MAX; }
-    for (idx = 0; idx < KB_MINS_RING_SIZE; idx++) { kb_mins_ring[idx].shortest_gap_ns = U64_MAX; }
-    for (idx = 0; idx < KB_HOURS_RING_SIZE; idx++) { kb_hours_ring[idx].shortest_gap_ns = U64_MAX; }
-    for (idx = 0; idx < KB_DAYS_RING_SIZE; idx++) { kb_days_ring[idx].shortest_gap_ns = U64_MAX; }
+    BUILD_BUG_ON(KB_KEY_SLOT_CUNT > U8_MAX + 1);
+    BUILD_BUG_ON(offsetofend(kb_kbd_t, alt_held) - offsetof(kb_kbd_t, last_press_ns) > SMP_CACHE_BYTES);
 
-    kb_bucket_zero(&kb_live);
-    memset(kb_key_press_ts, 0, sizeof(kb_key_press_ts));
+    for (idx = 0; idx < KB_KEY_MAX; idx++) { kb_key_slot[idx] = (idx < KB_KEY_DIRECT_CUNT) ? (uint8_t)idx : KB_KEY_SLOT_OVERFLOW; }
 
-    kb_init_ns = ktime_get_ns();
+    for (idx = 0; idx < ARRAY_SIZE(kb_key_extra); idx++) { kb_key_slot[kb_key_extra[idx]] = (uint8_t)(KB_KEY_DIRECT_CUNT + idx); }
+
+    kb_map_refresh(kb_glob.scratch);
 
     err = input_register_handler(&kb_handler);
     if (unlikely(err))
     {
         printk(KERN_ERR "KayBeeStat: failed to reg input handler\n");
-        kvfree(kb_secs_ring);
-        kvfree(kb_mins_ring);
-        kvfree(kb_hours_ring);
-        kvfree(kb_days_ring);
-        kvfree(kb_scratch_timer);
-        kvfree(kb_scratch_rd);
+        kb_tiers_free(&kb_glob);
+        vfree(kb_map_pub);
+        vfree(kb_map_full);
+        destroy_workqueue(kb_wq);
         return err;
     }
 
@@ -662,17 +2626,20 @@ static int __init kb_init(void)
     {
         printk(KERN_ERR "KayBeeStat: failed to reg misc dev\n");
         input_unregister_handler(&kb_handler);
-        kvfree(kb_secs_ring);
-        kvfree(kb_mins_ring);
-        kvfree(kb_hours_ring);
-        kvfree(kb_days_ring);
-        kvfree(kb_scratch_timer);
-        kvfree(kb_scratch_rd);
+        kb_tiers_free(&kb_glob);
+        vfree(kb_map_pub);
+        vfree(kb_map_full);
+        destroy_workqueue(kb_wq);
         return err;
     }
 
-    timer_setup(&kb_timer, kb_timer_cb, 0);
-    mod_timer(&kb_timer, jiffies + HZ);
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 13, 0)
+    hrtimer_setup(&kb_timer, kb_timer_cb, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+#else
+    hrtimer_init(&kb_timer, CLOCK_MONOTONIC, HRTIMER_MODE_ABS_SOFT);
+    kb_timer.function = kb_timer_cb;
+#endif
+    hrtimer_start(&kb_timer, kb_tick_next(kb_init_ns), HRTIMER_MODE_ABS_SOFT);
 
     printk(KERN_INFO "KayBeeStat: module init; /dev/kaybeestat ready\n");
     return 0;
@@ -682,9 +2649,15 @@ static void __exit kb_exit(void)
 {
     printk(KERN_INFO "KayBeeStat: unloading...\n");
 
+    // under kb_lock so a concurrent kb_wake() can't re-arm the timer or queue work past this point
+
+    spin_lock_irq(&kb_lock);
     WRITE_ONCE(kb_shutdown, 1);
-    smp_wmb();
-    timer_delete_sync(&kb_timer);
+    spin_unlock_irq(&kb_lock);
+
+    hrtimer_cancel(&kb_timer);
+    destroy_workqueue(kb_wq);
+    wake_up_interruptible_all(&kb_tick_wq);
 
     misc_deregister(&kb_misc_dev);
     input_unregister_handler(&kb_handler);
@@ -692,12 +2665,9 @@ static void __exit kb_exit(void)
     spin_lock(&kb_lock);
     spin_unlock(&kb_lock);
 
-    kvfree(kb_secs_ring);
-    kvfree(kb_mins_ring);
-    kvfree(kb_hours_ring);
-    kvfree(kb_days_ring);
-    kvfree(kb_scratch_timer);
-    kvfree(kb_scratch_rd);
+    kb_tiers_free(&kb_glob);
+    vfree(kb_map_pub);
+    vfree(kb_map_full);
 
     printk(KERN_INFO "KayBeeStat: unloaded\n");
 }
@@ -8,16 +8,20 @@
 #include <errno.h>
 #include <sys/stat.h>
 #include <sys/file.h>
+#include <sys/mman.h>
+#include <poll.h>
 #include <grp.h>
 #include <time.h>
 
 #define KB_KEY_MAX 768
 #define KB_WINDOW_CUNT 8
+#define KB_KEY_CLASS_CUNT 7
 #define KB_STATE_DIR "/var/lib/kaybeestat"
 #define KB_STATE_FILE KB_STATE_DIR "/stats.bin"
 #define KB_PUB_FILE KB_STATE_DIR "/stats.pub"
 #define KB_DEV "/dev/kaybeestat"
 #define KB_SAVE_INTERVAL_SECS 60
+#define KB_MAP_FULL_OFF 0x10000
 
 typedef struct
 {
@@ -36,6 +40,13 @@ typedef struct
     uint64_t gap_var_ns;
     uint64_t shortest_gap_ns;
     uint64_t longest_gap_ns;
+    uint64_t hold_p50_ns;
+    uint64_t hold_p90_ns;
+    uint64_t hold_p99_ns;
+    uint64_t gap_p50_ns;
+    uint64_t gap_p90_ns;
+    uint64_t gap_p99_ns;
+    uint64_t class_cunt[KB_KEY_CLASS_CUNT];
     uint32_t per_key_cunt[KB_KEY_MAX];
 } kb_window_stats_t;
 
@@ -65,6 +76,13 @@ typedef struct
     uint64_t gap_var_ns;
     uint64_t shortest_gap_ns;
     uint64_t longest_gap_ns;
+    uint64_t hold_p50_ns;
+    uint64_t hold_p90_ns;
+    uint64_t hold_p99_ns;
+    uint64_t gap_p50_ns;
+    uint64_t gap_p90_ns;
+    uint64_t gap_p99_ns;
+    uint64_t class_cunt[KB_KEY_CLASS_CUNT];
 } kb_window_stats_pub_t;
 
 typedef struct
@@ -76,6 +94,13 @@ typedef struct
     kb_window_stats_pub_t windows[KB_WINDOW_CUNT];
 } kb_stats_pub_t;
 
+typedef struct
+{
+    uint32_t seq;
+    uint32_t pudding;
+    kb_stats_t stats;
+} kb_map_t;
+
 typedef struct
 {
     uint64_t total_uptime_ns;
@@ -87,6 +112,8 @@ typedef struct
 
 static volatile sig_atomic_t kb_running = 1;
 static kb_persistent_t kb_baseline = { 0 };
+static int kb_dev_fd = -1;
+static const kb_map_t *kb_map = NULL;
 
 static void kb_signal_handler(int sig)
 {
@@ -199,20 +226,76 @@ static int kb_pub_file_write(const kb_stats_pub_t *pub)
     return 0;
 }
 
-static int kb_device_read(kb_stats_t *stats)
+// the open fd and the mapping pin the module; stop the daemon before unloading it
+
+static int kb_device_open(void)
+{
+    void *map = NULL;
+
+    if (kb_dev_fd >= 0) { return 0; }
+
+    kb_dev_fd = open(KB_DEV, O_RDONLY);
+    if (kb_dev_fd < 0) { return -1; }
+
+    map = mmap(NULL, sizeof(kb_map_t), PROT_READ, MAP_SHARED, kb_dev_fd, KB_MAP_FULL_OFF);
+    if (map != MAP_FAILED) { kb_map = map; }
+
+    return 0;
+}
+
+// a read catches the module's rings up first, so it is exact even while the tick is stopped for idle
+
+static int kb_device_pread(kb_stats_t *stats)
 {
-    int fd = 0;
     ssize_t ret = 0;
 
-    fd = open(KB_DEV, O_RDONLY);
-    if (fd < 0) { return -1; }
+    if (kb_device_open() < 0) { return -1; }
 
-    ret = read(fd, stats, sizeof(*stats));
-    close(fd);
+    ret = pread(kb_dev_fd, stats, sizeof(*stats), 0);
 
     return (ret == sizeof(*stats)) ? 0 : -1;
 }
 
+// the map is as of the last closed second, which is what kb_tick_wait waits for; pread if it can't be mapped
+
+static int kb_device_read(kb_stats_t *stats)
+{
+    uint32_t seq = 0;
+
+    if (kb_device_open() < 0) { return -1; }
+
+    if (!kb_map) { return kb_device_pread(stats); }
+
+    do
+    {
+        seq = __atomic_load_n(&kb_map->seq, __ATOMIC_ACQUIRE);
+        memcpy(stats, &kb_map->stats, sizeof(*stats));
+        __atomic_thread_fence(__ATOMIC_ACQUIRE);
+    } while ((seq & 1) || seq != __atomic_load_n(&kb_map->seq, __ATOMIC_RELAXED));
+
+    return 0;
+}
+
+// blocks until the module closes a second and has rewritten the map; while it is idle no second
+// closes, so this only comes back at the save interval
+
+static void kb_tick_wait(void)
+{
+    struct pollfd pfd;
+
+    if (kb_dev_fd < 0)
+    {
+        sleep(1);
+        return;
+    }
+
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = kb_dev_fd;
+    pfd.events = POLLIN;
+
+    if (poll(&pfd, 1, KB_SAVE_INTERVAL_SECS * 1000) < 0 && errno != EINTR) { sleep(1); }
+}
+
 static void kb_stats_accumulate(kb_persistent_t *accum, const kb_stats_t *current)
 {
     accum->total_uptime_ns = kb_baseline.total_uptime_ns + current->uptime_ns;
@@ -246,6 +329,13 @@ static void kb_pub_build(kb_stats_pub_t *pub, const kb_stats_t *current, const k
         pub->windows[i].gap_var_ns = current->windows[i].gap_var_ns;
         pub->windows[i].shortest_gap_ns = current->windows[i].shortest_gap_ns;
         pub->windows[i].longest_gap_ns = current->windows[i].longest_gap_ns;
+        pub->windows[i].hold_p50_ns = current->windows[i].hold_p50_ns;
+        pub->windows[i].hold_p90_ns = current->windows[i].hold_p90_ns;
+        pub->windows[i].hold_p99_ns = current->windows[i].hold_p99_ns;
+        pub->windows[i].gap_p50_ns = current->windows[i].gap_p50_ns;
+        pub->windows[i].gap_p90_ns = current->windows[i].gap_p90_ns;
+        pub->windows[i].gap_p99_ns = current->windows[i].gap_p99_ns;
+        memcpy(pub->windows[i].class_cunt, current->windows[i].class_cunt, sizeof(pub->windows[i].class_cunt));
     }
 
     pub->windows[0].keystroke_cunt = accum->total_keystrokes;
@@ -299,15 +389,19 @@ int main(void)
             if (now - last_save >= KB_SAVE_INTERVAL_SECS) { if (kb_state_save(&accum) == 0) { last_save = now; } }
         }
 
-        sleep(1);
+        kb_tick_wait();
     }
 
-    if (kb_device_read(&current) == 0)
+    if (kb_device_pread(&current) == 0)
     {
         kb_stats_accumulate(&accum, &current);
         (void)kb_state_save(&accum);
     }
 
+    if (kb_map) { munmap((void *)kb_map, sizeof(kb_map_t)); }
+
+    if (kb_dev_fd >= 0) { close(kb_dev_fd); }
+
     fprintf(stdout, "kaybeestatd: shutdown; saved %lu keystrokes\n", (unsigned long)accum.total_keystrokes);
 
     return 0;
@@ -1,3 +1,5 @@
+#define _GNU_SOURCE
+
 #include <stdint.h>
 #include <stddef.h>
 #include <inttypes.h>
@@ -14,6 +16,9 @@
 #include <linux/uinput.h>
 #include <linux/input.h>
 #include <sys/ioctl.h>
+#include <sys/mman.h>
+#include <poll.h>
+#include <time.h>
 
 // test harness
 
@@ -32,6 +37,24 @@ static uint32_t kb_test_fail_cunt = 0;
 
 #define KB_KEY_MAX 768
 #define KB_WINDOW_CUNT 8
+#define KB_KEY_CLASS_PRINTABLE 0
+#define KB_KEY_CLASS_MODIFIER 1
+#define KB_KEY_CLASS_NAVIGATION 2
+#define KB_KEY_CLASS_FUNCTION 3
+#define KB_KEY_CLASS_NUMPAD 4
+#define KB_KEY_CLASS_DELETION 5
+#define KB_KEY_CLASS_WHITESPACE 6
+#define KB_KEY_CLASS_CUNT 7
+#define KB_MAP_FULL_OFF 0x10000
+#define KB_IOC_MAGIC 'k'
+#define KB_IOC_STREAM _IOW(KB_IOC_MAGIC, 1, uint32_t)
+#define KB_IOC_QUERY _IOWR(KB_IOC_MAGIC, 2, kb_query_t)
+#define KB_IOC_KBD_LIST _IOWR(KB_IOC_MAGIC, 3, kb_kbd_list_t)
+#define KB_IOC_KBD_QUERY _IOWR(KB_IOC_MAGIC, 4, kb_kbd_query_t)
+#define KB_IOC_RANGE _IOWR(KB_IOC_MAGIC, 5, kb_range_query_t)
+#define KB_PHYS_LEN 64
+#define KB_QUERY_SCALAR 0x1
+#define KB_QUERY_PERKEY 0x2
 
 typedef struct
 {
@@ -50,6 +73,13 @@ typedef struct
     uint64_t gap_var_ns;
     uint64_t shortest_gap_ns;
     uint64_t longest_gap_ns;
+    uint64_t hold_p50_ns;
+    uint64_t hold_p90_ns;
+    uint64_t hold_p99_ns;
+    uint64_t gap_p50_ns;
+    uint64_t gap_p90_ns;
+    uint64_t gap_p99_ns;
+    uint64_t class_cunt[KB_KEY_CLASS_CUNT];
     uint32_t per_key_cunt[KB_KEY_MAX];
 } kb_window_stats_t;
 
@@ -79,6 +109,13 @@ typedef struct
     uint64_t gap_var_ns;
     uint64_t shortest_gap_ns;
     uint64_t longest_gap_ns;
+    uint64_t hold_p50_ns;
+    uint64_t hold_p90_ns;
+    uint64_t hold_p99_ns;
+    uint64_t gap_p50_ns;
+    uint64_t gap_p90_ns;
+    uint64_t gap_p99_ns;
+    uint64_t class_cunt[KB_KEY_CLASS_CUNT];
 } kb_window_stats_pub_t;
 
 typedef struct
@@ -90,9 +127,84 @@ typedef struct
     kb_window_stats_pub_t windows[KB_WINDOW_CUNT];
 } kb_stats_pub_t;
 
+typedef struct
+{
+    uint64_t tick;
+    uint32_t press_cunt;
+    uint32_t release_cunt;
+    uint32_t char_cunt;
+    uint32_t char_del_cunt;
+    uint32_t word_del_cunt;
+    uint32_t hold_cunt;
+    uint32_t gap_cunt;
+    uint32_t peak_press_cunt;
+    uint64_t hold_sum_ns;
+    uint64_t hold_var_ns;
+    uint64_t longest_hold_ns;
+    uint64_t gap_sum_ns;
+    uint64_t gap_var_ns;
+    uint64_t shortest_gap_ns;
+    uint64_t longest_gap_ns;
+} kb_tick_rec_t;
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t pudding;
+    kb_stats_pub_t stats;
+} kb_map_pub_t;
+
+typedef struct
+{
+    uint32_t seq;
+    uint32_t pudding;
+    kb_stats_t stats;
+} kb_map_t;
+
+typedef struct
+{
+    uint32_t window_mask;
+    uint32_t field_mask;
+    uint64_t uptime_ns;
+    uint64_t buff;
+    uint64_t buff_len;
+} kb_query_t;
+
+typedef struct
+{
+    uint16_t vendor;
+    uint16_t product;
+    uint32_t pudding;
+    char phys[KB_PHYS_LEN];
+} kb_kbd_id_t;
+
+typedef struct
+{
+    uint32_t cunt;
+    uint32_t pudding;
+    uint64_t buff;
+    uint64_t buff_len;
+} kb_kbd_list_t;
+
+typedef struct
+{
+    kb_kbd_id_t id;
+    kb_query_t query;
+} kb_kbd_query_t;
+
+typedef struct
+{
+    uint32_t tier;
+    uint32_t off;
+    uint32_t len;
+    uint32_t pudding;
+    uint64_t uptime_ns;
+    kb_window_stats_pub_t stats;
+} kb_range_query_t;
+
 // uinput
 
-static int kb_uinput_dev_create(void)
+static int kb_uinput_dev_create_as(uint16_t product, const char *phys)
 {
     int fd = 0;
     struct uinput_setup setup;
@@ -109,10 +221,16 @@ static int kb_uinput_dev_create(void)
 
     for (idx = 0; idx < KEY_MAX; idx++) { (void)ioctl(fd, UI_SET_KEYBIT, idx); }
 
+    if (phys && ioctl(fd, UI_SET_PHYS, phys) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
     memset(&setup, 0, sizeof(setup));
     setup.id.bustype = BUS_USB;
     setup.id.vendor = 0x1234;
-    setup.id.product = 0x5678;
+    setup.id.product = product;
     strncpy(setup.name, "kaybeestat_test_kb", UINPUT_MAX_NAME_SIZE - 1);
 
     if (ioctl(fd, UI_DEV_SETUP, &setup) < 0)
@@ -131,6 +249,48 @@ static int kb_uinput_dev_create(void)
     return fd;
 }
 
+static int kb_uinput_dev_create(void)
+{
+    return kb_uinput_dev_create_as(0x5678, NULL);
+}
+
+// EV_KEY with buttons only, as a mouse reports it
+
+static int kb_uinput_mouse_create(void)
+{
+    int fd = 0;
+    struct uinput_setup setup;
+
+    fd = open("/dev/uinput", O_WRONLY | O_NONBLOCK);
+    if (fd < 0) { return -1; }
+
+    if (ioctl(fd, UI_SET_EVBIT, EV_KEY) < 0 || ioctl(fd, UI_SET_EVBIT, EV_REL) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    (void)ioctl(fd, UI_SET_KEYBIT, BTN_LEFT);
+    (void)ioctl(fd, UI_SET_KEYBIT, BTN_RIGHT);
+    (void)ioctl(fd, UI_SET_RELBIT, REL_X);
+    (void)ioctl(fd, UI_SET_RELBIT, REL_Y);
+
+    memset(&setup, 0, sizeof(setup));
+    setup.id.bustype = BUS_USB;
+    setup.id.vendor = 0x1234;
+    setup.id.product = 0x5680;
+    strncpy(setup.name, "kaybeestat_test_mouse", UINPUT_MAX_NAME_SIZE - 1);
+
+    if (ioctl(fd, UI_DEV_SETUP, &setup) < 0 || ioctl(fd, UI_DEV_CREATE) < 0)
+    {
+        close(fd);
+        return -1;
+    }
+
+    usleep(500000);
+    return fd;
+}
+
 static void kb_uinput_dev_destroy(int fd)
 {
     (void)ioctl(fd, UI_DEV_DESTROY);
@@ -159,6 +319,32 @@ static int kb_uinput_key_emit(int fd, uint16_t keycode, int32_t val)
     return 0;
 }
 
+// several key values in one SYN frame, as a chorded or NKRO report would deliver them
+
+static int kb_uinput_chord_emit(int fd, const uint16_t *keycodes, size_t cunt, int32_t val)
+{
+    struct input_event ev;
+    size_t idx = 0;
+
+    for (idx = 0; idx < cunt; idx++)
+    {
+        memset(&ev, 0, sizeof(ev));
+        ev.type = EV_KEY;
+        ev.code = keycodes[idx];
+        ev.value = val;
+
+        if (write(fd, &ev, sizeof(ev)) < 0) { return -1; }
+    }
+
+    memset(&ev, 0, sizeof(ev));
+    ev.type = EV_SYN;
+    ev.code = SYN_REPORT;
+
+    if (write(fd, &ev, sizeof(ev)) < 0) { return -1; }
+
+    return 0;
+}
+
 static int kb_uinput_key_press(int fd, uint16_t keycode)
 {
     if (kb_uinput_key_emit(fd, keycode, 1) < 0) { return -1; }
@@ -184,6 +370,97 @@ static int kb_stats_rd(int dev_fd, kb_stats_t *stats)
     return 0;
 }
 
+static int kb_stream_enable(int dev_fd)
+{
+    uint32_t enable = 1;
+
+    return ioctl(dev_fd, KB_IOC_STREAM, &enable);
+}
+
+static int kb_query(int dev_fd, uint32_t window_mask, uint32_t field_mask, void *buff, size_t buff_len)
+{
+    kb_query_t q;
+
+    memset(&q, 0, sizeof(q));
+    q.window_mask = window_mask;
+    q.field_mask = field_mask;
+    q.buff = (uint64_t)(uintptr_t)buff;
+    q.buff_len = buff_len;
+
+    return ioctl(dev_fd, KB_IOC_QUERY, &q);
+}
+
+static int kb_kbd_query_up(int dev_fd, uint16_t product, const char *phys, uint32_t window_mask, void *buff, size_t buff_len, uint64_t *uptime_ns)
+{
+    kb_kbd_query_t q;
+    int ret = 0;
+
+    memset(&q, 0, sizeof(q));
+    q.id.vendor = 0x1234;
+    q.id.product = product;
+    strncpy(q.id.phys, phys, KB_PHYS_LEN - 1);
+    q.query.window_mask = window_mask;
+    q.query.field_mask = KB_QUERY_SCALAR;
+    q.query.buff = (uint64_t)(uintptr_t)buff;
+    q.query.buff_len = buff_len;
+
+    ret = ioctl(dev_fd, KB_IOC_KBD_QUERY, &q);
+    if (uptime_ns) { *uptime_ns = q.query.uptime_ns; }
+
+    return ret;
+}
+
+static int kb_kbd_query(int dev_fd, uint16_t product, const char *phys, uint32_t window_mask, void *buff, size_t buff_len)
+{
+    return kb_kbd_query_up(dev_fd, product, phys, window_mask, buff, buff_len, NULL);
+}
+
+static int kb_range(int dev_fd, uint32_t tier, uint32_t off, uint32_t len, kb_range_query_t *q)
+{
+    memset(q, 0, sizeof(*q));
+    q->tier = tier;
+    q->off = off;
+    q->len = len;
+
+    return ioctl(dev_fd, KB_IOC_RANGE, q);
+}
+
+static uint32_t kb_map_seq_rd(const uint32_t *seq)
+{
+    return __atomic_load_n(seq, __ATOMIC_ACQUIRE);
+}
+
+// reloads the module with params, or loads it if a failed reload left it out, and waits for udev to
+// bring the node back
+
+static int kb_module_reload(const char *params)
+{
+    char cmd[128];
+    uint32_t idx = 0;
+
+    snprintf(cmd, sizeof(cmd), "{ ! test -d /sys/module/kaybeestat || rmmod kaybeestat; } && modprobe kaybeestat %s", params);
+    if (system(cmd) != 0) { return -1; }
+
+    for (idx = 0; idx < 50; idx++)
+    {
+        if (access("/dev/kaybeestat", R_OK) == 0) { return 0; }
+
+        usleep(100000);
+    }
+
+    return -1;
+}
+
+// ticks sit on whole CLOCK_MONOTONIC seconds, so this lands halfway between two of them
+
+static void kb_mid_second_wait(void)
+{
+    struct timespec ts;
+
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    usleep((useconds_t)(((ts.tv_nsec < 500000000L) ? (500000000L - ts.tv_nsec) : (1500000000L - ts.tv_nsec)) / 1000));
+}
+
 // chardev tests
 
 static void kb_test_dev_open_close(void)
@@ -314,10 +591,13 @@ static void kb_test_rdwr_rejected(void)
 
 static void kb_test_struct_size(void)
 {
-    KB_TEST_ASSERT(sizeof(kb_window_stats_t) == 15 * 8 + KB_KEY_MAX * 4, "kb_window_stats_t size mismatch");
+    KB_TEST_ASSERT(sizeof(kb_window_stats_t) == 28 * 8 + KB_KEY_MAX * 4, "kb_window_stats_t size mismatch");
     KB_TEST_ASSERT(sizeof(kb_stats_t) == 16 + KB_WINDOW_CUNT * sizeof(kb_window_stats_t), "kb_stats_t size mismatch");
-    KB_TEST_ASSERT(sizeof(kb_window_stats_pub_t) == 15 * 8, "kb_window_stats_pub_t size mismatch");
+    KB_TEST_ASSERT(sizeof(kb_window_stats_pub_t) == 28 * 8, "kb_window_stats_pub_t size mismatch");
     KB_TEST_ASSERT(sizeof(kb_stats_pub_t) == 16 + KB_WINDOW_CUNT * sizeof(kb_window_stats_pub_t), "kb_stats_pub_t size mismatch");
+    KB_TEST_ASSERT(sizeof(kb_tick_rec_t) == 8 + 8 * 4 + 7 * 8, "kb_tick_rec_t size mismatch");
+    KB_TEST_ASSERT(sizeof(kb_kbd_id_t) == 8 + KB_PHYS_LEN, "kb_kbd_id_t size mismatch");
+    KB_TEST_ASSERT(sizeof(kb_kbd_query_t) == sizeof(kb_kbd_id_t) + sizeof(kb_query_t), "kb_kbd_query_t size mismatch");
 }
 
 static void kb_test_multiple_opens(void)
@@ -401,6 +681,55 @@ static void kb_test_perms_unprivileged_denied(void)
     KB_TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) == 0, "unprivileged user should be denied access");
 }
 
+// root is decided at open: a file opened unprivileged keeps getting the public record once its
+// process is root again. the saved uid stays root so the child can raise itself back
+
+static void kb_test_unprivileged_open_stays_pub(void)
+{
+    pid_t pid = 0;
+    int status = 0;
+    struct passwd *nobody = NULL;
+    struct group *grp = NULL;
+
+    nobody = getpwnam("nobody");
+    grp = getgrnam("kaybeestat");
+    if (!nobody || !grp)
+    {
+        fprintf(stdout, "  SKIP: no \"nobody\" user or \"kaybeestat\" group\n");
+        kb_test_pass_cunt++;
+        return;
+    }
+
+    pid = fork();
+    KB_TEST_ASSERT(pid >= 0, "fork failed");
+
+    if (pid == 0)
+    {
+        kb_stats_t stats;
+        ssize_t ret = 0;
+        int fd = 0;
+
+        if (setgroups(1, &grp->gr_gid) < 0 || setresgid(grp->gr_gid, grp->gr_gid, grp->gr_gid) < 0) { _exit(2); }
+
+        if (setresuid(nobody->pw_uid, nobody->pw_uid, 0) < 0) { _exit(2); }
+
+        fd = open("/dev/kaybeestat", O_RDONLY);
+        if (fd < 0) { _exit(2); }
+
+        if (setresuid(0, 0, 0) < 0) { _exit(2); }
+
+        ret = read(fd, &stats, sizeof(stats));
+        close(fd);
+
+        _exit((ret == (ssize_t)sizeof(kb_stats_pub_t)) ? 0 : 1);
+    }
+
+    (void)waitpid(pid, &status, 0);
+    KB_TEST_ASSERT(WIFEXITED(status) && WEXITSTATUS(status) != 1, "fd opened unprivileged should read the public record as root");
+
+    if (WEXITSTATUS(status) == 2) { fprintf(stdout, "  SKIP: couldn't open as the kaybeestat group\n"); }
+}
+
 static void kb_test_root_gets_full_stats(void)
 {
     int fd = 0;
@@ -598,6 +927,45 @@ static void kb_test_autorepeat_ignored(void)
     kb_uinput_dev_destroy(uinput_fd);
 }
 
+static void kb_test_chord_frame_counted(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_stats_t before;
+    kb_stats_t after;
+    const uint16_t chord[2] = { KEY_LEFTCTRL, KEY_W };
+    uint64_t press_delta = 0;
+    uint64_t release_delta = 0;
+    uint64_t word_del_delta = 0;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &before) == 0, "baseline read failed");
+
+    KB_TEST_ASSERT(kb_uinput_chord_emit(uinput_fd, chord, 2, 1) == 0, "chord press failed");
+    usleep(20000);
+    KB_TEST_ASSERT(kb_uinput_chord_emit(uinput_fd, chord, 2, 0) == 0, "chord release failed");
+    usleep(50000);
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &after) == 0, "after read failed");
+
+    press_delta = after.windows[0].keystroke_cunt - before.windows[0].keystroke_cunt;
+    release_delta = after.windows[0].release_cunt - before.windows[0].release_cunt;
+    word_del_delta = after.windows[0].word_del_cunt - before.windows[0].word_del_cunt;
+
+    fprintf(stdout, "  chord: press %" PRIu64 "; release %" PRIu64 "; word del %" PRIu64 "\n", press_delta, release_delta, word_del_delta);
+    KB_TEST_ASSERT(press_delta == 2, "both keys of a one-frame chord should count as presses");
+    KB_TEST_ASSERT(release_delta == 2, "both keys of a one-frame release should count");
+    KB_TEST_ASSERT(word_del_delta == 1, "ctrl earlier in the same frame should apply to W");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
 // per-key tests
 
 static void kb_test_per_key_cunt(void)
@@ -678,6 +1046,82 @@ static void kb_test_per_key_cunt_sum_matches_total(void)
     kb_uinput_dev_destroy(uinput_fd);
 }
 
+static void kb_test_per_key_extra_and_overflow(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_stats_t before;
+    kb_stats_t after;
+    uint32_t delta_f13 = 0;
+    uint32_t delta_home = 0;
+    uint32_t delta_overflow = 0;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &before) == 0, "baseline read failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_F13) == 0, "key press F13 failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_HOMEPAGE) == 0, "key press HOMEPAGE failed");
+    usleep(50000);
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &after) == 0, "after read failed");
+
+    delta_f13 = after.windows[0].per_key_cunt[KEY_F13] - before.windows[0].per_key_cunt[KEY_F13];
+    delta_home = after.windows[0].per_key_cunt[KEY_HOMEPAGE] - before.windows[0].per_key_cunt[KEY_HOMEPAGE];
+    delta_overflow = after.windows[0].per_key_cunt[KEY_RESERVED] - before.windows[0].per_key_cunt[KEY_RESERVED];
+
+    fprintf(stdout, "  per_key: F13=%" PRIu32 " HOMEPAGE=%" PRIu32 " overflow=%" PRIu32 "\n", delta_f13, delta_home, delta_overflow);
+
+    KB_TEST_ASSERT(delta_f13 >= 1, "KEY_F13 should keep its own slot");
+    KB_TEST_ASSERT(delta_home == 0, "KEY_HOMEPAGE has no slot of its own");
+    KB_TEST_ASSERT(delta_overflow >= 1, "unmapped keys should land under KEY_RESERVED");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+// one key per class on a fresh device, plus one without a class; space is printable and whitespace
+
+static void kb_test_key_classes_counted(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t win;
+    const uint16_t keys[] = { KEY_LEFT, KEY_LEFTSHIFT, KEY_F5, KEY_KP1, KEY_DELETE, KEY_SPACE, KEY_HOMEPAGE };
+    size_t idx = 0;
+
+    uinput_fd = kb_uinput_dev_create_as(0x5681, "kaybeestat-test/classes");
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    for (idx = 0; idx < sizeof(keys) / sizeof(keys[0]); idx++) { KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, keys[idx]) == 0, "key press failed"); }
+
+    usleep(50000);
+
+    memset(&win, 0, sizeof(win));
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x5681, "kaybeestat-test/classes", 1U << 0, &win, sizeof(win)) == 0, "query failed");
+
+    fprintf(stdout, "  classes: prn=%" PRIu64 " mod=%" PRIu64 " nav=%" PRIu64 " fn=%" PRIu64 " kp=%" PRIu64 " del=%" PRIu64 " ws=%" PRIu64 "\n", win.class_cunt[KB_KEY_CLASS_PRINTABLE], win.class_cunt[KB_KEY_CLASS_MODIFIER], win.class_cunt[KB_KEY_CLASS_NAVIGATION], win.class_cunt[KB_KEY_CLASS_FUNCTION], win.class_cunt[KB_KEY_CLASS_NUMPAD], win.class_cunt[KB_KEY_CLASS_DELETION], win.class_cunt[KB_KEY_CLASS_WHITESPACE]);
+
+    KB_TEST_ASSERT(win.keystroke_cunt == 7, "every press should count as a keystroke");
+    KB_TEST_ASSERT(win.class_cunt[KB_KEY_CLASS_PRINTABLE] == 1 && win.char_cunt == 1, "only space is printable");
+    KB_TEST_ASSERT(win.class_cunt[KB_KEY_CLASS_MODIFIER] == 1, "shift should count as a modifier");
+    KB_TEST_ASSERT(win.class_cunt[KB_KEY_CLASS_NAVIGATION] == 1, "left should count as navigation");
+    KB_TEST_ASSERT(win.class_cunt[KB_KEY_CLASS_FUNCTION] == 1, "F5 should count as a function key");
+    KB_TEST_ASSERT(win.class_cunt[KB_KEY_CLASS_NUMPAD] == 1, "KP1 should count as numpad");
+    KB_TEST_ASSERT(win.class_cunt[KB_KEY_CLASS_DELETION] == 1, "delete should count as deletion");
+    KB_TEST_ASSERT(win.class_cunt[KB_KEY_CLASS_WHITESPACE] == 1, "space should count as whitespace");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
 static void kb_test_untouched_key_zero(void)
 {
     int dev_fd = 0;
@@ -948,27 +1392,543 @@ static void kb_test_multiple_reads_nondestructive(void)
     kb_uinput_dev_destroy(uinput_fd);
 }
 
-// kps tests
+// mmap tests
 
-static void kb_test_kps_nonzero_after_typing(void)
+static void kb_test_mmap_pub(void)
 {
-    int uinput_fd = 0;
-    int dev_fd = 0;
-    kb_stats_t stats;
+    int fd = 0;
+    const kb_map_pub_t *map = NULL;
+    uint32_t seq_first = 0;
+    uint32_t seq_second = 0;
 
-    uinput_fd = kb_uinput_dev_create();
-    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
 
-    dev_fd = open("/dev/kaybeestat", O_RDONLY);
-    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+    map = mmap(NULL, sizeof(kb_map_pub_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    KB_TEST_ASSERT(map != MAP_FAILED, "mmap of public region failed");
 
-    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_A) == 0, "press A failed");
-    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_B) == 0, "press B failed");
-    usleep(50000);
+    seq_first = kb_map_seq_rd(&map->seq);
+    usleep(1100000);
+    seq_second = kb_map_seq_rd(&map->seq);
 
-    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &stats) == 0, "read failed");
+    fprintf(stdout, "  seq: %" PRIu32 " -> %" PRIu32 "; uptime: %" PRIu64 " ns\n", seq_first, seq_second, map->stats.uptime_ns);
+    KB_TEST_ASSERT(seq_second > seq_first, "mapped stats should be refreshed every tick");
+    KB_TEST_ASSERT((seq_second & 1) == 0, "seq should be even outside a refresh");
+    KB_TEST_ASSERT(map->stats.uptime_ns > 0, "mapped uptime should be nonzero");
 
-    fprintf(stdout, "  avg_kps: %" PRIu64 ".%03" PRIu64 "\n", stats.windows[0].avg_kps / 1000, stats.windows[0].avg_kps % 1000);
+    munmap((void *)map, sizeof(kb_map_pub_t));
+}
+
+static void kb_test_mmap_full_root(void)
+{
+    int fd = 0;
+    const kb_map_t *map = NULL;
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+
+    map = mmap(NULL, sizeof(kb_map_t), PROT_READ, MAP_SHARED, fd, KB_MAP_FULL_OFF);
+    close(fd);
+    KB_TEST_ASSERT(map != MAP_FAILED, "root mmap of full region failed");
+    KB_TEST_ASSERT(map->stats.uptime_ns > 0, "mapped uptime should be nonzero");
+
+    munmap((void *)map, sizeof(kb_map_t));
+}
+
+static void kb_test_mmap_write_rejected(void)
+{
+    int fd = 0;
+    void *map = NULL;
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+
+    map = mmap(NULL, sizeof(kb_map_pub_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    KB_TEST_ASSERT(map == MAP_FAILED, "writable mmap should be rejected");
+}
+
+static void kb_test_mmap_bad_offset(void)
+{
+    int fd = 0;
+    void *map = NULL;
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+
+    map = mmap(NULL, 4096, PROT_READ, MAP_SHARED, fd, 2 * KB_MAP_FULL_OFF);
+    close(fd);
+    KB_TEST_ASSERT(map == MAP_FAILED, "mmap at unknown offset should be rejected");
+}
+
+// the daemon's loop: poll a plain fd and copy out of the map, never read()ing
+
+static void kb_test_mmap_poll_without_read(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    const kb_map_t *map = NULL;
+    struct pollfd pfd;
+    uint64_t before = 0;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    map = mmap(NULL, sizeof(kb_map_t), PROT_READ, MAP_SHARED, dev_fd, KB_MAP_FULL_OFF);
+    KB_TEST_ASSERT(map != MAP_FAILED, "mmap of full region failed");
+
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = dev_fd;
+    pfd.events = POLLIN;
+
+    KB_TEST_ASSERT(poll(&pfd, 1, 2500) == 1, "first poll should report the last closed second");
+    KB_TEST_ASSERT(poll(&pfd, 1, 0) == 0, "a reported second should not be reported again");
+
+    before = map->stats.windows[0].keystroke_cunt;
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_M) == 0, "press M failed");
+
+    KB_TEST_ASSERT(poll(&pfd, 1, 2500) == 1 && (pfd.revents & POLLIN), "poll should wake for the next closed second");
+
+    fprintf(stdout, "  map 1m presses: %" PRIu64 " -> %" PRIu64 "\n", before, map->stats.windows[0].keystroke_cunt);
+    KB_TEST_ASSERT(map->stats.windows[0].keystroke_cunt > before, "map should hold the press once poll wakes");
+
+    munmap((void *)map, sizeof(kb_map_t));
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+// streaming tests
+
+static void kb_test_stream_poll_wakes(void)
+{
+    int fd = 0;
+    struct pollfd pfd;
+    kb_tick_rec_t recs[4];
+    ssize_t ret = 0;
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+    KB_TEST_ASSERT(kb_stream_enable(fd) == 0, "stream ioctl failed");
+
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    KB_TEST_ASSERT(poll(&pfd, 1, 2500) == 1 && (pfd.revents & POLLIN), "poll should wake once a second closes");
+
+    ret = read(fd, recs, sizeof(recs));
+    fprintf(stdout, "  stream read: %zd bytes; first tick: %" PRIu64 "\n", ret, recs[0].tick);
+    KB_TEST_ASSERT(ret > 0 && ret % (ssize_t)sizeof(kb_tick_rec_t) == 0, "stream read should return whole records");
+    KB_TEST_ASSERT(recs[0].tick > 0, "record tick should be nonzero");
+
+    close(fd);
+}
+
+static void kb_test_stream_records_keystrokes(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_tick_rec_t rec;
+    uint64_t press_sum = 0;
+    uint64_t last_tick = 0;
+    uint32_t idx = 0;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+    KB_TEST_ASSERT(kb_stream_enable(dev_fd) == 0, "stream ioctl failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_U) == 0, "press U failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_I) == 0, "press I failed");
+
+    for (idx = 0; idx < 3 && press_sum < 2; idx++)
+    {
+        KB_TEST_ASSERT(read(dev_fd, &rec, sizeof(rec)) == (ssize_t)sizeof(rec), "blocking stream read failed");
+        KB_TEST_ASSERT(rec.tick > last_tick, "record ticks should increase");
+
+        last_tick = rec.tick;
+        press_sum += rec.press_cunt;
+    }
+
+    fprintf(stdout, "  streamed presses: %" PRIu64 "\n", press_sum);
+    KB_TEST_ASSERT(press_sum >= 2, "streamed records should carry the typed keystrokes");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_ioctl_unknown_rejected(void)
+{
+    int fd = 0;
+    int ret = 0;
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+
+    ret = ioctl(fd, _IO(KB_IOC_MAGIC, 0x7f));
+    KB_TEST_ASSERT(ret < 0 && errno == ENOTTY, "unknown ioctl should return ENOTTY");
+
+    close(fd);
+}
+
+// query tests
+
+static void kb_test_query_scalar_subset(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t wins[2];
+    kb_stats_t stats;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_O) == 0, "press O failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_P) == 0, "press P failed");
+    usleep(50000);
+
+    memset(wins, 0, sizeof(wins));
+    KB_TEST_ASSERT(kb_query(dev_fd, (1U << 0) | (1U << 7), KB_QUERY_SCALAR, wins, sizeof(wins)) == 0, "scalar query failed");
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &stats) == 0, "read failed");
+
+    fprintf(stdout, "  query: w0=%" PRIu64 " w7=%" PRIu64 "\n", wins[0].keystroke_cunt, wins[1].keystroke_cunt);
+    KB_TEST_ASSERT(wins[0].keystroke_cunt >= 2, "window 0 should carry the typed keystrokes");
+    KB_TEST_ASSERT(wins[1].keystroke_cunt >= wins[0].keystroke_cunt, "second record should be the 365d window");
+    KB_TEST_ASSERT(wins[1].keystroke_cunt <= stats.windows[7].keystroke_cunt, "query should not run ahead of a later read");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_query_perkey(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_t win;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_J) == 0, "press J failed");
+    usleep(50000);
+
+    memset(&win, 0, sizeof(win));
+    KB_TEST_ASSERT(kb_query(dev_fd, 1U << 0, KB_QUERY_SCALAR | KB_QUERY_PERKEY, &win, sizeof(win)) == 0, "per-key query failed");
+
+    fprintf(stdout, "  query per_key J: %" PRIu32 "\n", win.per_key_cunt[KEY_J]);
+    KB_TEST_ASSERT(win.per_key_cunt[KEY_J] >= 1, "per-key query should count KEY_J");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_query_perkey_only(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_t win;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_J) == 0, "press J failed");
+    usleep(50000);
+
+    memset(&win, 0xff, sizeof(win));
+    KB_TEST_ASSERT(kb_query(dev_fd, 1U << 0, KB_QUERY_PERKEY, &win, sizeof(win)) == 0, "per-key-only query failed");
+
+    fprintf(stdout, "  per-key-only: J %" PRIu32 "; keystrokes %" PRIu64 "; hold p50 %" PRIu64 "\n", win.per_key_cunt[KEY_J], win.keystroke_cunt, win.hold_p50_ns);
+    KB_TEST_ASSERT(win.per_key_cunt[KEY_J] >= 1, "per-key-only query should count KEY_J");
+    KB_TEST_ASSERT(win.keystroke_cunt == 0 && win.avg_kps == 0 && win.hold_var_ns == 0 && win.hold_p50_ns == 0, "per-key-only query should leave the scalars zero");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_query_bad_mask(void)
+{
+    int fd = 0;
+    kb_window_stats_pub_t win;
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_query(fd, 0, KB_QUERY_SCALAR, &win, sizeof(win)) < 0 && errno == EINVAL, "empty window mask should return EINVAL");
+    KB_TEST_ASSERT(kb_query(fd, 1U << KB_WINDOW_CUNT, KB_QUERY_SCALAR, &win, sizeof(win)) < 0 && errno == EINVAL, "unknown window should return EINVAL");
+    KB_TEST_ASSERT(kb_query(fd, 1U << 0, 0x80, &win, sizeof(win)) < 0 && errno == EINVAL, "unknown field should return EINVAL");
+
+    close(fd);
+}
+
+static void kb_test_query_short_buff(void)
+{
+    int fd = 0;
+    kb_window_stats_pub_t wins[2];
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_query(fd, 0x7, KB_QUERY_SCALAR, wins, sizeof(wins)) < 0 && errno == EINVAL, "short query buffer should return EINVAL");
+
+    close(fd);
+}
+
+// per-device tests
+
+static void kb_test_kbd_list_has_test_dev(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_kbd_id_t ids[64];
+    kb_kbd_list_t l;
+    uint32_t idx = 0;
+    int found = 0;
+
+    uinput_fd = kb_uinput_dev_create_as(0x5679, "kaybeestat-test/list");
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    memset(&l, 0, sizeof(l));
+    l.buff = (uint64_t)(uintptr_t)ids;
+    l.buff_len = sizeof(ids);
+    KB_TEST_ASSERT(ioctl(dev_fd, KB_IOC_KBD_LIST, &l) == 0, "device list failed");
+
+    for (idx = 0; idx < l.cunt && idx < 64; idx++) { if (ids[idx].vendor == 0x1234 && ids[idx].product == 0x5679 && strcmp(ids[idx].phys, "kaybeestat-test/list") == 0) { found = 1; } }
+
+    fprintf(stdout, "  devices: %" PRIu32 "\n", l.cunt);
+    KB_TEST_ASSERT(found, "test device should be listed");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_kbd_query_separates_devs(void)
+{
+    int a_fd = 0;
+    int b_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t a_win;
+    kb_window_stats_pub_t b_win;
+
+    a_fd = kb_uinput_dev_create_as(0x567a, "kaybeestat-test/a");
+    KB_TEST_ASSERT(a_fd >= 0, "uinput a create failed");
+
+    b_fd = kb_uinput_dev_create_as(0x567b, "kaybeestat-test/b");
+    KB_TEST_ASSERT(b_fd >= 0, "uinput b create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(a_fd, KEY_A) == 0, "press A failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(a_fd, KEY_S) == 0, "press S failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(a_fd, KEY_D) == 0, "press D failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(b_fd, KEY_F) == 0, "press F failed");
+    usleep(50000);
+
+    memset(&a_win, 0, sizeof(a_win));
+    memset(&b_win, 0, sizeof(b_win));
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x567a, "kaybeestat-test/a", 1U << 0, &a_win, sizeof(a_win)) == 0, "query a failed");
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x567b, "kaybeestat-test/b", 1U << 0, &b_win, sizeof(b_win)) == 0, "query b failed");
+
+    fprintf(stdout, "  per-device: a=%" PRIu64 " b=%" PRIu64 "\n", a_win.keystroke_cunt, b_win.keystroke_cunt);
+    KB_TEST_ASSERT(a_win.keystroke_cunt == 3, "device a should count only its own keystrokes");
+    KB_TEST_ASSERT(b_win.keystroke_cunt == 1, "device b should count only its own keystrokes");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(b_fd);
+    kb_uinput_dev_destroy(a_fd);
+}
+
+// the same key held on two devices at once used to share one press timestamp
+
+static void kb_test_kbd_overlapping_holds(void)
+{
+    int a_fd = 0;
+    int b_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t a_win;
+    kb_window_stats_pub_t b_win;
+
+    a_fd = kb_uinput_dev_create_as(0x567c, "kaybeestat-test/hold-a");
+    KB_TEST_ASSERT(a_fd >= 0, "uinput a create failed");
+
+    b_fd = kb_uinput_dev_create_as(0x567d, "kaybeestat-test/hold-b");
+    KB_TEST_ASSERT(b_fd >= 0, "uinput b create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_emit(a_fd, KEY_X, 1) == 0, "press X on a failed");
+    usleep(100000);
+    KB_TEST_ASSERT(kb_uinput_key_emit(b_fd, KEY_X, 1) == 0, "press X on b failed");
+    usleep(50000);
+    KB_TEST_ASSERT(kb_uinput_key_emit(b_fd, KEY_X, 0) == 0, "release X on b failed");
+    usleep(50000);
+    KB_TEST_ASSERT(kb_uinput_key_emit(a_fd, KEY_X, 0) == 0, "release X on a failed");
+    usleep(50000);
+
+    memset(&a_win, 0, sizeof(a_win));
+    memset(&b_win, 0, sizeof(b_win));
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x567c, "kaybeestat-test/hold-a", 1U << 0, &a_win, sizeof(a_win)) == 0, "query a failed");
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x567d, "kaybeestat-test/hold-b", 1U << 0, &b_win, sizeof(b_win)) == 0, "query b failed");
+
+    fprintf(stdout, "  overlapping holds: a=%" PRIu64 " ns b=%" PRIu64 " ns\n", a_win.avg_hold_ns, b_win.avg_hold_ns);
+    KB_TEST_ASSERT(a_win.avg_hold_ns >= 150000000ULL, "device a's hold should span b's");
+    KB_TEST_ASSERT(b_win.avg_hold_ns > 0 && b_win.avg_hold_ns < a_win.avg_hold_ns, "device b should keep its own hold");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(b_fd);
+    kb_uinput_dev_destroy(a_fd);
+}
+
+static void kb_test_kbd_mouse_ignored(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_kbd_id_t ids[64];
+    kb_kbd_list_t l;
+    kb_stats_t before;
+    kb_stats_t after;
+    uint32_t idx = 0;
+    int found = 0;
+
+    uinput_fd = kb_uinput_mouse_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &before) == 0, "read before failed");
+
+    for (idx = 0; idx < 5; idx++) { KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, BTN_LEFT) == 0, "click failed"); }
+
+    usleep(50000);
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &after) == 0, "read after failed");
+
+    memset(&l, 0, sizeof(l));
+    l.buff = (uint64_t)(uintptr_t)ids;
+    l.buff_len = sizeof(ids);
+    KB_TEST_ASSERT(ioctl(dev_fd, KB_IOC_KBD_LIST, &l) == 0, "device list failed");
+
+    for (idx = 0; idx < l.cunt && idx < 64; idx++) { if (ids[idx].vendor == 0x1234 && ids[idx].product == 0x5680) { found = 1; } }
+
+    KB_TEST_ASSERT(!found, "mouse should not be attached");
+    KB_TEST_ASSERT(after.windows[7].keystroke_cunt == before.windows[7].keystroke_cunt, "mouse clicks should not count as keystrokes");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_kbd_query_unknown_dev(void)
+{
+    int fd = 0;
+    kb_window_stats_pub_t win;
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_kbd_query(fd, 0xfffe, "kaybeestat-test/none", 1U << 0, &win, sizeof(win)) < 0 && errno == ENODEV, "unknown device should return ENODEV");
+
+    close(fd);
+}
+
+// range tests
+
+static void kb_test_range_closed_seconds(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_range_query_t before;
+    kb_range_query_t after;
+    kb_range_query_t newest;
+    kb_stats_t stats;
+    struct timespec ts;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_R) == 0, "press R failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_N) == 0, "press N failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_G) == 0, "press G failed");
+
+    // let the second holding the presses close and roll into the ring, then query well clear of the next tick
+
+    usleep(1000000);
+    KB_TEST_ASSERT(clock_gettime(CLOCK_MONOTONIC, &ts) == 0, "clock_gettime failed");
+    usleep((useconds_t)((1300000000L - ts.tv_nsec) % 1000000000L / 1000));
+
+    KB_TEST_ASSERT(kb_range(dev_fd, 0, 0, 60, &after) == 0, "60 s range failed");
+    KB_TEST_ASSERT(kb_range(dev_fd, 0, 0, 3, &newest) == 0, "3 s range failed");
+    KB_TEST_ASSERT(kb_range(dev_fd, 0, 3, 57, &before) == 0, "older range failed");
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &stats) == 0, "read failed");
+
+    fprintf(stdout, "  range: 60s=%" PRIu64 " newest 3s=%" PRIu64 " older=%" PRIu64 "\n", after.stats.keystroke_cunt, newest.stats.keystroke_cunt, before.stats.keystroke_cunt);
+    KB_TEST_ASSERT(newest.stats.keystroke_cunt >= 3, "the newest seconds should carry the presses");
+    KB_TEST_ASSERT(after.stats.keystroke_cunt == newest.stats.keystroke_cunt + before.stats.keystroke_cunt, "adjacent ranges should add up");
+    KB_TEST_ASSERT(after.stats.keystroke_cunt <= stats.windows[0].keystroke_cunt, "closed seconds should not exceed the 1m window");
+    KB_TEST_ASSERT(newest.stats.longest_hold_ns > 0, "extremes should come through");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_range_bad_args(void)
+{
+    int fd = 0;
+    kb_range_query_t q;
+
+    fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_range(fd, 4, 0, 1, &q) < 0 && errno == EINVAL, "unknown tier should return EINVAL");
+    KB_TEST_ASSERT(kb_range(fd, 0, 0, 0, &q) < 0 && errno == EINVAL, "empty range should return EINVAL");
+    KB_TEST_ASSERT(kb_range(fd, 2, 20, 5, &q) < 0 && errno == EINVAL, "range past the ring should return EINVAL");
+    KB_TEST_ASSERT(kb_range(fd, 3, 0, 365, &q) == 0, "the whole day ring should be a valid range");
+
+    close(fd);
+}
+
+// kps tests
+
+static void kb_test_kps_nonzero_after_typing(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_stats_t stats;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_A) == 0, "press A failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_B) == 0, "press B failed");
+    usleep(50000);
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &stats) == 0, "read failed");
+
+    fprintf(stdout, "  avg_kps: %" PRIu64 ".%03" PRIu64 "\n", stats.windows[0].avg_kps / 1000, stats.windows[0].avg_kps % 1000);
     KB_TEST_ASSERT(stats.windows[0].avg_kps > 0, "avg_kps should be nonzero after typing");
 
     close(dev_fd);
@@ -991,6 +1951,81 @@ static void kb_test_peak_kps_gte_avg(void)
     close(dev_fd);
 }
 
+// 20 presses 20 ms apart, started 800 ms into a second; whole-second buckets would split the burst
+
+static void kb_test_peak_kps_straddles_second(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t win;
+    struct timespec ts;
+    uint32_t idx = 0;
+
+    uinput_fd = kb_uinput_dev_create_as(0x5682, "kaybeestat-test/burst");
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(clock_gettime(CLOCK_MONOTONIC, &ts) == 0, "clock_gettime failed");
+    usleep((useconds_t)((1800000000L - ts.tv_nsec) % 1000000000L / 1000));
+
+    for (idx = 0; idx < 20; idx++) { KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_K) == 0, "press K failed"); }
+
+    usleep(50000);
+
+    memset(&win, 0, sizeof(win));
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x5682, "kaybeestat-test/burst", 1U << 0, &win, sizeof(win)) == 0, "query failed");
+
+    fprintf(stdout, "  straddling burst peak: %" PRIu64 "\n", win.peak_kps);
+    KB_TEST_ASSERT(win.peak_kps == 20 * 1000, "the whole burst should fall in one sliding second");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+// a keyboard younger than its 1m window averages over its own uptime, both while the presses sit in
+// the live second and once they have closed
+
+static void kb_test_rate_young_kbd_exact(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t win;
+    uint64_t uptime_ns = 0;
+    uint64_t expected = 0;
+    uint32_t idx = 0;
+    uint32_t pass = 0;
+
+    uinput_fd = kb_uinput_dev_create_as(0x5684, "kaybeestat-test/rate");
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    kb_mid_second_wait();
+
+    for (idx = 0; idx < 5; idx++) { KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_K) == 0, "press K failed"); }
+
+    for (pass = 0; pass < 2; pass++)
+    {
+        if (pass == 1) { kb_mid_second_wait(); }
+
+        memset(&win, 0, sizeof(win));
+        KB_TEST_ASSERT(kb_kbd_query_up(dev_fd, 0x5684, "kaybeestat-test/rate", 1U << 0, &win, sizeof(win), &uptime_ns) == 0, "query failed");
+
+        expected = (uptime_ns > 0) ? (win.keystroke_cunt * 1000ULL * 1000000000ULL / uptime_ns) : 0;
+        fprintf(stdout, "  %s: %" PRIu64 " presses over %" PRIu64 " ns; avg_kps %" PRIu64 " (expected %" PRIu64 ")\n", pass ? "closed" : "live", win.keystroke_cunt, uptime_ns, win.avg_kps, expected);
+
+        KB_TEST_ASSERT(uptime_ns < 60000000000ULL, "keyboard should still be younger than its 1m window");
+        KB_TEST_ASSERT(win.keystroke_cunt == 5, "1m window should hold every press");
+        KB_TEST_ASSERT(win.avg_kps + 1 >= expected && win.avg_kps <= expected + 1, "1m avg_kps should average over the keyboard's uptime");
+    }
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
 static void kb_test_rate_window_scaling(void)
 {
     int dev_fd = 0;
@@ -1379,6 +2414,89 @@ static void kb_test_single_hold_zero_variance(void)
     kb_uinput_dev_destroy(uinput_fd);
 }
 
+// holds each of the cunt keys of a batch for its own time
+
+static int kb_holds_emit(int fd, const useconds_t *holds_us, size_t cunt)
+{
+    size_t idx = 0;
+
+    for (idx = 0; idx < cunt; idx++)
+    {
+        if (kb_uinput_key_emit(fd, KEY_V, 1) < 0) { return -1; }
+
+        usleep(holds_us[idx]);
+        if (kb_uinput_key_emit(fd, KEY_V, 0) < 0) { return -1; }
+
+        usleep(20000);
+    }
+
+    return 0;
+}
+
+// within a fifth of the analytic value, leaving room for the scheduler's slack on each hold
+
+static int kb_var_near(uint64_t var_ns, uint64_t expected_ns)
+{
+    return (var_ns >= expected_ns - expected_ns / 5) && (var_ns <= expected_ns + expected_ns / 5);
+}
+
+// holds of 50/150 ms have a population variance of (50 ms)^2; a second batch of 100/300 ms lands on
+// top, and once the first batch slides out of the 1m window that window holds the second alone
+
+static void kb_test_hold_variance_exact(void)
+{
+    static const useconds_t first[] = { 50000, 150000, 50000, 150000 };
+    static const useconds_t second[] = { 100000, 300000, 100000, 300000 };
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t win[2];
+    struct timespec first_ts;
+    struct timespec now_ts;
+
+    uinput_fd = kb_uinput_dev_create_as(0x5685, "kaybeestat-test/var");
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_holds_emit(uinput_fd, first, sizeof(first) / sizeof(first[0])) == 0, "first batch failed");
+    clock_gettime(CLOCK_MONOTONIC, &first_ts);
+
+    memset(win, 0, sizeof(win));
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x5685, "kaybeestat-test/var", 1U << 0, &win[0], sizeof(win[0])) == 0, "query failed");
+    fprintf(stdout, "  first batch: 1m hold_var_ns %" PRIu64 " (expected 2500000000000000)\n", win[0].hold_var_ns);
+    KB_TEST_ASSERT(win[0].release_cunt == 4, "1m window should hold the first batch");
+    KB_TEST_ASSERT(kb_var_near(win[0].hold_var_ns, 2500000000000000ULL), "1m hold variance should match the first batch");
+
+    fprintf(stdout, "  waiting 30 s...\n");
+    sleep(30);
+
+    KB_TEST_ASSERT(kb_holds_emit(uinput_fd, second, sizeof(second) / sizeof(second[0])) == 0, "second batch failed");
+
+    memset(win, 0, sizeof(win));
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x5685, "kaybeestat-test/var", (1U << 0) | (1U << 1), win, sizeof(win)) == 0, "query failed");
+    fprintf(stdout, "  both batches: 1m hold_var_ns %" PRIu64 " (expected 8750000000000000)\n", win[0].hold_var_ns);
+    KB_TEST_ASSERT(win[0].release_cunt == 8, "1m window should hold both batches");
+    KB_TEST_ASSERT(kb_var_near(win[0].hold_var_ns, 8750000000000000ULL), "1m hold variance should match both batches");
+
+    // past 60 closed seconds plus the live one since the first batch, it has left the 1m window
+
+    clock_gettime(CLOCK_MONOTONIC, &now_ts);
+    fprintf(stdout, "  waiting for the first batch to slide out...\n");
+    if (now_ts.tv_sec < first_ts.tv_sec + 63) { sleep((unsigned int)(first_ts.tv_sec + 63 - now_ts.tv_sec)); }
+
+    memset(win, 0, sizeof(win));
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x5685, "kaybeestat-test/var", (1U << 0) | (1U << 1), win, sizeof(win)) == 0, "query failed");
+    fprintf(stdout, "  after the slide: 1m hold_var_ns %" PRIu64 " (expected 10000000000000000); 5m %" PRIu64 " (expected 8750000000000000)\n", win[0].hold_var_ns, win[1].hold_var_ns);
+    KB_TEST_ASSERT(win[0].release_cunt == 4, "1m window should hold the second batch alone");
+    KB_TEST_ASSERT(kb_var_near(win[0].hold_var_ns, 10000000000000000ULL), "1m hold variance should match the second batch alone");
+    KB_TEST_ASSERT(win[1].release_cunt == 8, "5m window should still hold both batches");
+    KB_TEST_ASSERT(kb_var_near(win[1].hold_var_ns, 8750000000000000ULL), "5m hold variance should still match both batches");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
 static void kb_test_avg_gap_ordering(void)
 {
     int uinput_fd = 0;
@@ -1408,8 +2526,295 @@ static void kb_test_avg_gap_ordering(void)
     kb_uinput_dev_destroy(uinput_fd);
 }
 
+// param tests
+
+static void kb_test_clock_param_default(void)
+{
+    FILE *fp = NULL;
+    char buff[16];
+
+    fp = fopen("/sys/module/kaybeestat/parameters/clock", "r");
+    KB_TEST_ASSERT(fp != NULL, "clock param should be exposed in sysfs");
+
+    memset(buff, 0, sizeof(buff));
+    KB_TEST_ASSERT(fgets(buff, sizeof(buff), fp) != NULL, "clock param read failed");
+    fclose(fp);
+
+    fprintf(stdout, "  clock: %s", buff);
+    KB_TEST_ASSERT(strncmp(buff, "input", 5) == 0, "clock should default to the input core timestamp");
+}
+
+static void kb_test_allow_deny_params_default(void)
+{
+    FILE *fp = NULL;
+    char buff[16];
+
+    fp = fopen("/sys/module/kaybeestat/parameters/allow", "r");
+    KB_TEST_ASSERT(fp != NULL, "allow param should be exposed in sysfs");
+
+    memset(buff, 0, sizeof(buff));
+    KB_TEST_ASSERT(fgets(buff, sizeof(buff), fp) != NULL, "allow param read failed");
+    fclose(fp);
+    KB_TEST_ASSERT(buff[0] == '\n' || buff[0] == '\0', "allow should default to empty");
+
+    fp = fopen("/sys/module/kaybeestat/parameters/deny", "r");
+    KB_TEST_ASSERT(fp != NULL, "deny param should be exposed in sysfs");
+
+    memset(buff, 0, sizeof(buff));
+    KB_TEST_ASSERT(fgets(buff, sizeof(buff), fp) != NULL, "deny param read failed");
+    fclose(fp);
+    KB_TEST_ASSERT(buff[0] == '\n' || buff[0] == '\0', "deny should default to empty");
+}
+
+static void kb_test_arena_params_default(void)
+{
+    static const char *const names[] = { "secs", "mins", "hours", "days", "perkey", "max_kb" };
+    static const unsigned long expected[] = { 60, 60, 24, 365, 0xf, 8192 };
+    FILE *fp = NULL;
+    char path[64];
+    char buff[16];
+    size_t idx = 0;
+
+    for (idx = 0; idx < sizeof(names) / sizeof(names[0]); idx++)
+    {
+        snprintf(path, sizeof(path), "/sys/module/kaybeestat/parameters/%s", names[idx]);
+        fp = fopen(path, "r");
+        KB_TEST_ASSERT(fp != NULL, "arena param should be exposed in sysfs");
+
+        memset(buff, 0, sizeof(buff));
+        KB_TEST_ASSERT(fgets(buff, sizeof(buff), fp) != NULL, "arena param read failed");
+        fclose(fp);
+        KB_TEST_ASSERT(strtoul(buff, NULL, 10) == expected[idx], "arena param should hold its default");
+    }
+}
+
+// idle tests
+
+static void kb_test_idle_catch_up(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    const kb_map_t *map = NULL;
+    kb_stats_t stats;
+    struct pollfd pfd;
+    uint64_t map_uptime_ns = 0;
+    uint32_t idx = 0;
+
+    uinput_fd = kb_uinput_dev_create_as(0x5683, "kaybeestat-test/idle");
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    map = mmap(NULL, sizeof(kb_map_t), PROT_READ, MAP_SHARED, dev_fd, KB_MAP_FULL_OFF);
+    KB_TEST_ASSERT(map != MAP_FAILED, "mmap of full region failed");
+
+    for (idx = 0; idx < 4; idx++) { KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_J) == 0, "press J failed"); }
+
+    KB_TEST_ASSERT(pread(dev_fd, &stats, sizeof(stats), 0) == (ssize_t)sizeof(stats), "read failed");
+
+    // the presses slide out of the seconds window and the tick stops; the minute holding them has closed
+
+    fprintf(stdout, "  idling 65 s...\n");
+    sleep(65);
+
+    // a poll on a plain fd catches the rings up and wakes once the map is rewritten
+
+    memset(&pfd, 0, sizeof(pfd));
+    pfd.fd = dev_fd;
+    pfd.events = POLLIN;
+    KB_TEST_ASSERT(poll(&pfd, 1, 2500) == 1 && (pfd.revents & POLLIN), "poll should wake after the catch-up");
+
+    map_uptime_ns = map->stats.uptime_ns;
+    fprintf(stdout, "  map after idle: 1m %" PRIu64 ", 5m %" PRIu64 " presses; uptime %" PRIu64 " ns\n", map->stats.windows[0].keystroke_cunt, map->stats.windows[1].keystroke_cunt, map_uptime_ns);
+    KB_TEST_ASSERT(map->stats.windows[0].keystroke_cunt == 0, "mapped 1m window should be empty after idle");
+    KB_TEST_ASSERT(map->stats.windows[1].keystroke_cunt >= 4, "mapped 5m window should still hold the presses");
+
+    KB_TEST_ASSERT(pread(dev_fd, &stats, sizeof(stats), 0) == (ssize_t)sizeof(stats), "read failed");
+    KB_TEST_ASSERT(stats.windows[0].keystroke_cunt == 0, "1m window should be empty after idle");
+    KB_TEST_ASSERT(stats.windows[1].keystroke_cunt >= 4, "5m window should still hold the presses");
+    KB_TEST_ASSERT(stats.uptime_ns - map_uptime_ns < 2000000000ULL, "mapped uptime should have caught up with the idle time");
+
+    munmap((void *)map, sizeof(kb_map_t));
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+// percentile tests
+
+static void kb_test_hold_percentiles_ordered(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_stats_t stats;
+    const kb_window_stats_t *w = &stats.windows[0];
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_emit(uinput_fd, KEY_N, 1) == 0, "press failed");
+    usleep(150000);
+    KB_TEST_ASSERT(kb_uinput_key_emit(uinput_fd, KEY_N, 0) == 0, "release failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_B) == 0, "press B failed");
+    usleep(50000);
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &stats) == 0, "read failed");
+
+    fprintf(stdout, "  hold p50: %" PRIu64 "; p90: %" PRIu64 "; p99: %" PRIu64 "; longest: %" PRIu64 "\n", w->hold_p50_ns, w->hold_p90_ns, w->hold_p99_ns, w->longest_hold_ns);
+    KB_TEST_ASSERT(w->hold_p50_ns > 0, "hold p50 should be nonzero after a hold");
+    KB_TEST_ASSERT(w->hold_p50_ns <= w->hold_p90_ns && w->hold_p90_ns <= w->hold_p99_ns, "hold percentiles should be ordered");
+    KB_TEST_ASSERT(w->hold_p99_ns <= w->longest_hold_ns, "hold p99 should not exceed the longest hold");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_gap_percentiles_ordered(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_stats_t stats;
+    size_t idx = 0;
+
+    uinput_fd = kb_uinput_dev_create();
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_V) == 0, "press V failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_C) == 0, "press C failed");
+    KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_X) == 0, "press X failed");
+    usleep(50000);
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &stats) == 0, "read failed");
+
+    fprintf(stdout, "  gap p50: %" PRIu64 "; p90: %" PRIu64 "; p99: %" PRIu64 "\n", stats.windows[0].gap_p50_ns, stats.windows[0].gap_p90_ns, stats.windows[0].gap_p99_ns);
+    KB_TEST_ASSERT(stats.windows[0].gap_p50_ns > 0, "gap p50 should be nonzero after typing");
+
+    for (idx = 0; idx < KB_WINDOW_CUNT; idx++)
+    {
+        const kb_window_stats_t *w = &stats.windows[idx];
+
+        KB_TEST_ASSERT(w->gap_p50_ns <= w->gap_p90_ns && w->gap_p90_ns <= w->gap_p99_ns, "gap percentiles should be ordered in every window");
+        KB_TEST_ASSERT(w->gap_p99_ns <= w->longest_gap_ns, "gap p99 should not exceed the longest gap");
+    }
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
 // runner
 
+// short ring tests
+
+// with mins=1 the 5m window is cut to one minute, so past that minute its rate must divide by the
+// minute it covers and not by the uptime. the presses land in the first minute after load, which is
+// the one closed minute kept until the second closes at 120 s
+
+static void kb_test_short_ring_span_clamped(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t win;
+    uint64_t uptime_ns = 0;
+    uint64_t lo = 0;
+    uint64_t hi = 0;
+    uint32_t idx = 0;
+
+    uinput_fd = kb_uinput_dev_create_as(0x5686, "kaybeestat-test/short");
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    for (idx = 0; idx < 6; idx++) { KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_L) == 0, "press L failed"); }
+
+    fprintf(stdout, "  waiting 75 s...\n");
+    sleep(75);
+
+    memset(&win, 0, sizeof(win));
+    KB_TEST_ASSERT(kb_kbd_query_up(dev_fd, 0x5686, "kaybeestat-test/short", 1U << 1, &win, sizeof(win), &uptime_ns) == 0, "query failed");
+
+    // one closed minute plus at most a second and a half of live time
+
+    lo = 6ULL * 1000 * 1000000000ULL / 61500000000ULL;
+    hi = 6ULL * 1000 * 1000000000ULL / 60000000000ULL;
+    fprintf(stdout, "  5m over mins=1: %" PRIu64 " presses; avg_kps %" PRIu64 " (expected %" PRIu64 "-%" PRIu64 "); uptime %" PRIu64 " ns\n", win.keystroke_cunt, win.avg_kps, lo, hi, uptime_ns);
+    KB_TEST_ASSERT(uptime_ns > 62000000000ULL && uptime_ns < 120000000000ULL, "query should land in the second minute after load");
+    KB_TEST_ASSERT(win.keystroke_cunt == 6, "cut 5m window should hold the closed first minute");
+    KB_TEST_ASSERT(win.avg_kps >= lo && win.avg_kps <= hi, "cut 5m window should average over the minute it covers");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_short_ring(void)
+{
+    if (kb_module_reload("mins=1") != 0)
+    {
+        fprintf(stdout, "  SKIP: module can't be reloaded\n");
+        kb_test_pass_cunt++;
+        return;
+    }
+
+    kb_test_short_ring_span_clamped();
+
+    KB_TEST_ASSERT(kb_module_reload("") == 0, "reload with defaults failed");
+}
+
+// arena budget tests
+
+// max_kb=1024 fits the all-device set but no device's own, so a keyboard is still attached and
+// counted in the all-device stats while its per-device query has nothing to return
+
+static void kb_test_budget_glob_only(void)
+{
+    int uinput_fd = 0;
+    int dev_fd = 0;
+    kb_window_stats_pub_t win;
+    kb_stats_t stats;
+    uint32_t idx = 0;
+
+    uinput_fd = kb_uinput_dev_create_as(0x5687, "kaybeestat-test/budget");
+    KB_TEST_ASSERT(uinput_fd >= 0, "uinput create failed");
+
+    dev_fd = open("/dev/kaybeestat", O_RDONLY);
+    KB_TEST_ASSERT(dev_fd >= 0, "open failed");
+
+    for (idx = 0; idx < 3; idx++) { KB_TEST_ASSERT(kb_uinput_key_press(uinput_fd, KEY_N) == 0, "press N failed"); }
+
+    usleep(50000);
+
+    memset(&win, 0, sizeof(win));
+    KB_TEST_ASSERT(kb_kbd_query(dev_fd, 0x5687, "kaybeestat-test/budget", 1U << 0, &win, sizeof(win)) < 0 && errno == ENODATA, "per-device query past max_kb should return ENODATA");
+
+    KB_TEST_ASSERT(kb_stats_rd(dev_fd, &stats) == 0, "read failed");
+    fprintf(stdout, "  all-device 1m presses past max_kb: %" PRIu64 "\n", stats.windows[0].keystroke_cunt);
+    KB_TEST_ASSERT(stats.windows[0].keystroke_cunt >= 3, "all-device stats should still count the keyboard");
+
+    close(dev_fd);
+    kb_uinput_dev_destroy(uinput_fd);
+}
+
+static void kb_test_budget(void)
+{
+    if (kb_module_reload("max_kb=1024") != 0)
+    {
+        fprintf(stdout, "  SKIP: module can't be reloaded with max_kb=1024\n");
+        kb_test_pass_cunt++;
+        (void)kb_module_reload("");
+        return;
+    }
+
+    kb_test_budget_glob_only();
+
+    KB_TEST_ASSERT(kb_module_reload("") == 0, "reload with defaults failed");
+}
+
 int main(void)
 {
     fprintf(stdout, "kaybeestat test suite\n\n");
@@ -1430,6 +2835,7 @@ int main(void)
     kb_test_perms_group_readable();
     kb_test_perms_unprivileged_denied();
     kb_test_root_gets_full_stats();
+    kb_test_unprivileged_open_stays_pub();
 
     fprintf(stdout, "-- uptime --\n");
     kb_test_uptime_monotonic();
@@ -1440,10 +2846,13 @@ int main(void)
     kb_test_press_release_balanced();
     kb_test_press_only_no_release();
     kb_test_autorepeat_ignored();
+    kb_test_chord_frame_counted();
 
     fprintf(stdout, "-- per-key --\n");
     kb_test_per_key_cunt();
     kb_test_per_key_cunt_sum_matches_total();
+    kb_test_per_key_extra_and_overflow();
+    kb_test_key_classes_counted();
     kb_test_untouched_key_zero();
 
     fprintf(stdout, "-- hold duration --\n");
@@ -1463,9 +2872,41 @@ int main(void)
     fprintf(stdout, "-- non-destructive reads --\n");
     kb_test_multiple_reads_nondestructive();
 
+    fprintf(stdout, "-- mmap --\n");
+    kb_test_mmap_pub();
+    kb_test_mmap_full_root();
+    kb_test_mmap_write_rejected();
+    kb_test_mmap_bad_offset();
+    kb_test_mmap_poll_without_read();
+
+    fprintf(stdout, "-- streaming --\n");
+    kb_test_stream_poll_wakes();
+    kb_test_stream_records_keystrokes();
+    kb_test_ioctl_unknown_rejected();
+
+    fprintf(stdout, "-- query --\n");
+    kb_test_query_scalar_subset();
+    kb_test_query_perkey();
+    kb_test_query_perkey_only();
+    kb_test_query_bad_mask();
+    kb_test_query_short_buff();
+
+    fprintf(stdout, "-- per-device --\n");
+    kb_test_kbd_list_has_test_dev();
+    kb_test_kbd_query_separates_devs();
+    kb_test_kbd_overlapping_holds();
+    kb_test_kbd_mouse_ignored();
+    kb_test_kbd_query_unknown_dev();
+
+    fprintf(stdout, "-- range --\n");
+    kb_test_range_closed_seconds();
+    kb_test_range_bad_args();
+
     fprintf(stdout, "-- kps --\n");
     kb_test_kps_nonzero_after_typing();
     kb_test_peak_kps_gte_avg();
+    kb_test_peak_kps_straddles_second();
+    kb_test_rate_young_kbd_exact();
     kb_test_rate_window_scaling();
     kb_test_rate_sane_magnitude();
 
@@ -1481,11 +2922,30 @@ int main(void)
     kb_test_gap_variance_nonzero();
     kb_test_variance_in_all_windows();
     kb_test_single_hold_zero_variance();
+    kb_test_hold_variance_exact();
     kb_test_avg_gap_ordering();
 
+    fprintf(stdout, "-- params --\n");
+    kb_test_clock_param_default();
+    kb_test_allow_deny_params_default();
+    kb_test_arena_params_default();
+
+    fprintf(stdout, "-- idle --\n");
+    kb_test_idle_catch_up();
+
+    fprintf(stdout, "-- percentiles --\n");
+    kb_test_hold_percentiles_ordered();
+    kb_test_gap_percentiles_ordered();
+
     fprintf(stdout, "-- stress --\n");
     kb_test_rapid_burst();
 
+    fprintf(stdout, "-- short rings --\n");
+    kb_test_short_ring();
+
+    fprintf(stdout, "-- arena budget --\n");
+    kb_test_budget();
+
     fprintf(stdout, "\nresults: %u passed; %u failed\n", kb_test_pass_cunt, kb_test_fail_cunt);
 
     if (kb_test_fail_cunt > 0) { return 1; }